@@ -96,9 +96,10 @@ project "lox"
          "src/**.c"
       }
 
-      -- ignore all testing files
+      -- ignore all testing and benchmark files
       removefiles {
          "src/test/**",
+         "src/bench/**",
          "src/**_test.*"
       }
 
@@ -176,7 +177,9 @@ project "test"
 
     -- ignore the lox main
     removefiles {
-        "src/main.c"
+        "src/main.c",
+        "src/bench/**",
+        "src/test/microbench.c"
      }
  
     filter { "system:macosx"}
@@ -195,6 +198,152 @@ project "test"
           "pthread",
        }
 
+-- the unit tests with a collection before every allocation that grows,
+-- catching objects the collector can't see
+project "test_stress"
+    kind "ConsoleApp"
+    language "C"
+    targetdir( "build" )
+    defines { 
+       "LOX_UNIT",
+       "DEBUG_STRESS_GC"
+    }
+ 
+    links {
+       "munit"
+    }
+ 
+    libdirs {
+       "build"
+    }
+ 
+    sysincludedirs {
+       "ext"
+    }
+ 
+    includedirs { 
+       "src"
+    }
+ 
+    files { 
+       "src/**.h",
+       "src/**.c",
+       
+    }
+
+    -- ignore the lox main
+    removefiles {
+        "src/main.c",
+        "src/bench/**",
+        "src/test/microbench.c"
+     }
+ 
+    filter { "system:macosx"}
+       links {
+          "c"
+       }
+    
+    filter { "system:linux"}
+       libdirs {
+          os.findlib("m"),
+          os.findlib("c")
+       }
+       links {
+          "c",
+          "m",
+          "pthread",
+       }
+
+project "bench"
+    kind "ConsoleApp"
+    language "C"
+    targetdir( "build" )
+    defines { 
+       "LOX_BENCH"
+    }
+ 
+    libdirs {
+       "build"
+    }
+ 
+    includedirs { 
+       "src"
+    }
+ 
+    files { 
+       "src/**.h",
+       "src/**.c",
+    }
+
+    -- ignore the lox main and the tests
+    removefiles {
+        "src/main.c",
+        "src/test/**",
+        "src/**_test.*"
+     }
+ 
+    filter { "system:macosx"}
+       links {
+          "c"
+       }
+    
+    filter { "system:linux"}
+       libdirs {
+          os.findlib("m"),
+          os.findlib("c")
+       }
+       links {
+          "c",
+          "dl",
+          "m",
+          "pthread",
+       }
+
+project "microbench"
+    kind "ConsoleApp"
+    language "C"
+    targetdir( "build" )
+    defines { 
+    }
+ 
+    libdirs {
+       "build"
+    }
+ 
+    includedirs { 
+       "src"
+    }
+ 
+    files { 
+       "src/**.h",
+       "src/**.c",
+    }
+
+    -- only the microbenchmarks' main
+    removefiles {
+        "src/main.c",
+        "src/bench/**",
+        "src/test/main.c",
+        "src/test/*_test.*",
+     }
+ 
+    filter { "system:macosx"}
+       links {
+          "c"
+       }
+    
+    filter { "system:linux"}
+       libdirs {
+          os.findlib("m"),
+          os.findlib("c")
+       }
+       links {
+          "c",
+          "dl",
+          "m",
+          "pthread",
+       }
+
 -- External Libraries
 
 project "munit"
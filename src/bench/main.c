@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LOX_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "common.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "vm.h"
+#include "lib/clock.h"
+#include "lib/file.h"
+
+// Runs each benchmark script a number of times in a fresh VM and reports
+// the median wall time, the interpreter's instructions per second and the
+// peak heap size. Results can be saved as a baseline and later runs
+// compared against it, a script whose median is slower than the baseline
+// by more than the threshold fails the run.
+
+#define BENCH_TRIALS    5
+#define BENCH_THRESHOLD 10.0  // percent
+#define BENCH_MAX_SCRIPTS 64
+
+typedef struct {
+    const char* script;
+    double      median;  // milliseconds
+    double      best;
+    double      instructions_per_second;
+    size_t      peak_bytes;
+    bool        failed;
+} bench_result_t;
+
+typedef struct {
+    char   script[256];
+    double median;
+    double instructions_per_second;
+    size_t peak_bytes;
+} bench_baseline_t;
+
+static const char* _scripts[] = {
+    "src/bench/scripts/fib.lox",
+    "src/bench/scripts/dispatch.lox",
+    "src/bench/scripts/strings.lox",
+    "src/bench/scripts/objects.lox",
+    "src/bench/scripts/gc.lox",
+    "src/bench/scripts/closures.lox",
+    "src/bench/scripts/numeric.lox",
+};
+
+// the scripts' output would bury the results, it's discarded while they run
+static int _silence_stdout() {
+    fflush(stdout);
+#ifdef LOX_WINDOWS
+    return -1;
+#else
+    int saved = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null != -1) {
+        dup2(null, STDOUT_FILENO);
+        close(null);
+    }
+    return saved;
+#endif
+}
+
+static void _restore_stdout(int saved) {
+    fflush(stdout);
+#ifndef LOX_WINDOWS
+    if (saved != -1) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+    }
+#endif
+}
+
+static int _compare_doubles(const void* a, const void* b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static bench_result_t _run(const char* script, int trials) {
+    bench_result_t result = { .script = script };
+    double* times = malloc(sizeof(double) * trials);
+    uint64_t instructions = 0;
+
+    for (int i = 0; i < trials; i++) {
+        l_init_vm();
+
+        int saved = _silence_stdout();
+        uint64_t start = l_now_ns();
+        int status = l_run_file(script);
+        uint64_t end = l_now_ns();
+        _restore_stdout(saved);
+
+        times[i] = (double)(end - start) / 1000000.0;
+        instructions = vm.instruction_count;
+        if (vm.gc_stats.peak_bytes > result.peak_bytes)
+            result.peak_bytes = vm.gc_stats.peak_bytes;
+
+        l_free_vm();
+
+        if (status != 0) {
+            result.failed = true;
+            break;
+        }
+    }
+
+    if (!result.failed) {
+        qsort(times, trials, sizeof(double), _compare_doubles);
+        result.best = times[0];
+        result.median = trials % 2 == 1 ? times[trials / 2]
+                                        : (times[trials / 2 - 1] + times[trials / 2]) / 2;
+        result.instructions_per_second = result.median > 0 ? instructions / (result.median / 1000.0) : 0;
+    }
+
+    free(times);
+    return result;
+}
+
+static int _load_baseline(const char* path, bench_baseline_t* baseline, int capacity) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open baseline \"%s\".\n", path);
+        exit(74);
+    }
+
+    char line[512];
+    int count = 0;
+    while (count < capacity && fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#')
+            continue;
+        bench_baseline_t* entry = &baseline[count];
+        if (sscanf(line, "%255s\t%lf\t%lf\t%zu",
+                   entry->script,
+                   &entry->median,
+                   &entry->instructions_per_second,
+                   &entry->peak_bytes) == 4) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static bool _save_baseline(const char* path, bench_result_t* results, int count) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    fprintf(file, "# lox benchmark baseline\n");
+    fprintf(file, "# script\tmedian_ms\tinstructions_per_second\tpeak_bytes\n");
+    for (int i = 0; i < count; i++) {
+        if (results[i].failed)
+            continue;
+        fprintf(file, "%s\t%.3f\t%.0f\t%zu\n",
+                results[i].script,
+                results[i].median,
+                results[i].instructions_per_second,
+                results[i].peak_bytes);
+    }
+    return fclose(file) == 0;
+}
+
+static bench_baseline_t* _find_baseline(bench_baseline_t* baseline, int count, const char* script) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(baseline[i].script, script) == 0)
+            return &baseline[i];
+    }
+    return NULL;
+}
+
+static const char* _name(const char* script) {
+    const char* slash = strrchr(script, '/');
+    return slash == NULL ? script : slash + 1;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* scripts[BENCH_MAX_SCRIPTS];
+    int script_count = 0;
+    int trials = BENCH_TRIALS;
+    double threshold = BENCH_THRESHOLD;
+    const char* save = NULL;
+    const char* compare = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-O", 2) == 0) {
+            const char* level = argv[i] + 2;
+            l_set_optimize_level(*level == '\0' ? OPTIMIZE_LEVEL_MAX : atoi(level));
+        } else if (strcmp(argv[i], "--jit") == 0) {
+#ifdef LOX_JIT
+            l_set_jit_enabled(true);
+#else
+            fprintf(stderr, "The JIT is not available on this platform.\n");
+#endif
+        } else if (strncmp(argv[i], "--trials=", 9) == 0) {
+            trials = atoi(argv[i] + 9);
+        } else if (strncmp(argv[i], "--threshold=", 12) == 0) {
+            threshold = atof(argv[i] + 12);
+        } else if (strncmp(argv[i], "--save=", 7) == 0) {
+            save = argv[i] + 7;
+        } else if (strncmp(argv[i], "--baseline=", 11) == 0) {
+            compare = argv[i] + 11;
+        } else if (argv[i][0] != '-' && script_count < BENCH_MAX_SCRIPTS) {
+            scripts[script_count++] = argv[i];
+        } else {
+            fprintf(stderr, "Usage: bench [-O<level>] [--jit] [--trials=<n>] [--threshold=<percent>] "
+                            "[--save=<baseline>] [--baseline=<baseline>] [script ...]\n");
+            exit(64);
+        }
+    }
+
+    if (trials < 1) {
+        fprintf(stderr, "--trials needs at least one trial.\n");
+        exit(64);
+    }
+
+    if (script_count == 0) {
+        script_count = sizeof(_scripts) / sizeof(_scripts[0]);
+        memcpy(scripts, _scripts, sizeof(_scripts));
+    }
+
+    bench_baseline_t baseline[BENCH_MAX_SCRIPTS];
+    int baseline_count = compare == NULL ? 0 : _load_baseline(compare, baseline, BENCH_MAX_SCRIPTS);
+
+    bench_result_t results[BENCH_MAX_SCRIPTS];
+    int regressions = 0;
+    int failures = 0;
+
+    printf("%d trials, -O%d%s\n", trials, l_get_optimize_level(),
+#ifdef LOX_JIT
+        l_jit_enabled() ? " --jit" : ""
+#else
+        ""
+#endif
+    );
+    printf("%-16s %10s %10s %10s %10s %10s\n",
+           "script", "median ms", "best ms", "Minstr/s", "peak KB", "baseline");
+
+    for (int i = 0; i < script_count; i++) {
+        bench_result_t* result = &results[i];
+        *result = _run(scripts[i], trials);
+
+        if (result->failed) {
+            printf("%-16s %10s\n", _name(result->script), "FAILED");
+            failures++;
+            continue;
+        }
+
+        printf("%-16s %10.2f %10.2f %10.1f %10.1f",
+               _name(result->script),
+               result->median,
+               result->best,
+               result->instructions_per_second / 1000000.0,
+               result->peak_bytes / 1024.0);
+
+        bench_baseline_t* previous = _find_baseline(baseline, baseline_count, result->script);
+        if (previous != NULL && previous->median > 0) {
+            double change = (result->median - previous->median) / previous->median * 100.0;
+            bool regressed = change > threshold;
+            printf(" %+9.1f%%%s", change, regressed ? " REGRESSED" : "");
+            if (regressed)
+                regressions++;
+        }
+        printf("\n");
+    }
+
+    if (save != NULL && !_save_baseline(save, results, script_count)) {
+        fprintf(stderr, "Could not write baseline \"%s\".\n", save);
+        exit(74);
+    }
+
+    if (regressions > 0) {
+        printf("%d script(s) more than %.1f%% slower than the baseline\n", regressions, threshold);
+    }
+
+    return failures > 0 || regressions > 0 ? 1 : 0;
+}
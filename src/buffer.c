@@ -0,0 +1,191 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "buffer.h"
+
+// The kernels below are written as simple counted loops over restrict
+// pointers so that the compiler can vectorise them. Reductions use
+// several independent accumulators, which keeps the result deterministic
+// without relying on -ffast-math to reassociate a single accumulator.
+
+static inline int32_t _to_int32(double value) {
+    if (value != value)
+        return 0;
+    if (value <= (double)INT32_MIN)
+        return INT32_MIN;
+    if (value >= (double)INT32_MAX)
+        return INT32_MAX;
+    return (int32_t)value;
+}
+
+static inline uint8_t _to_uint8(double value) {
+    if (value != value || value <= 0)
+        return 0;
+    if (value >= 255)
+        return 255;
+    return (uint8_t)value;
+}
+
+#define CONVERT_FLOAT64(value) (value)
+#define CONVERT_FLOAT32(value) ((float)(value))
+#define CONVERT_INT32(value)   _to_int32(value)
+#define CONVERT_UINT8(value)   _to_uint8(value)
+
+#define BUFFER_KERNELS(name, type, convert)                                   \
+    static void _fill_##name(type* restrict data, int count, double value) { \
+        type converted = convert(value);                                      \
+        for (int i = 0; i < count; i++)                                       \
+            data[i] = converted;                                              \
+    }                                                                         \
+                                                                              \
+    static double _sum_##name(const type* restrict data, int count) {        \
+        double s0 = 0, s1 = 0, s2 = 0, s3 = 0;                                \
+        int i = 0;                                                            \
+        for (; i + 4 <= count; i += 4) {                                      \
+            s0 += data[i];                                                    \
+            s1 += data[i + 1];                                                \
+            s2 += data[i + 2];                                                \
+            s3 += data[i + 3];                                                \
+        }                                                                     \
+        for (; i < count; i++)                                                \
+            s0 += data[i];                                                    \
+        return (s0 + s1) + (s2 + s3);                                         \
+    }                                                                         \
+                                                                              \
+    static double _min_##name(const type* restrict data, int count) {        \
+        type m0 = data[0], m1 = data[0], m2 = data[0], m3 = data[0];          \
+        int i = 0;                                                            \
+        for (; i + 4 <= count; i += 4) {                                      \
+            m0 = data[i]     < m0 ? data[i]     : m0;                         \
+            m1 = data[i + 1] < m1 ? data[i + 1] : m1;                         \
+            m2 = data[i + 2] < m2 ? data[i + 2] : m2;                         \
+            m3 = data[i + 3] < m3 ? data[i + 3] : m3;                         \
+        }                                                                     \
+        for (; i < count; i++)                                                \
+            m0 = data[i] < m0 ? data[i] : m0;                                 \
+        m0 = m1 < m0 ? m1 : m0;                                               \
+        m2 = m3 < m2 ? m3 : m2;                                               \
+        return m2 < m0 ? m2 : m0;                                             \
+    }                                                                         \
+                                                                              \
+    static double _max_##name(const type* restrict data, int count) {        \
+        type m0 = data[0], m1 = data[0], m2 = data[0], m3 = data[0];          \
+        int i = 0;                                                            \
+        for (; i + 4 <= count; i += 4) {                                      \
+            m0 = data[i]     > m0 ? data[i]     : m0;                         \
+            m1 = data[i + 1] > m1 ? data[i + 1] : m1;                         \
+            m2 = data[i + 2] > m2 ? data[i + 2] : m2;                         \
+            m3 = data[i + 3] > m3 ? data[i + 3] : m3;                         \
+        }                                                                     \
+        for (; i < count; i++)                                                \
+            m0 = data[i] > m0 ? data[i] : m0;                                 \
+        m0 = m1 > m0 ? m1 : m0;                                               \
+        m2 = m3 > m2 ? m3 : m2;                                               \
+        return m2 > m0 ? m2 : m0;                                             \
+    }                                                                         \
+                                                                              \
+    static void _scale_##name(type* restrict data, int count, double factor) {\
+        for (int i = 0; i < count; i++)                                       \
+            data[i] = convert(data[i] * factor);                              \
+    }
+
+BUFFER_KERNELS(float64, double,  CONVERT_FLOAT64)
+BUFFER_KERNELS(float32, float,   CONVERT_FLOAT32)
+BUFFER_KERNELS(int32,   int32_t, CONVERT_INT32)
+BUFFER_KERNELS(uint8,   uint8_t, CONVERT_UINT8)
+
+#undef BUFFER_KERNELS
+
+#define DISPATCH(buffer, kernel, ...)                                                  \
+    switch ((buffer)->type) {                                                          \
+        case BUFFER_FLOAT64: kernel##_float64((double*)(buffer)->data, __VA_ARGS__); break; \
+        case BUFFER_FLOAT32: kernel##_float32((float*)(buffer)->data, __VA_ARGS__); break;  \
+        case BUFFER_INT32:   kernel##_int32((int32_t*)(buffer)->data, __VA_ARGS__); break;  \
+        case BUFFER_UINT8:   kernel##_uint8((uint8_t*)(buffer)->data, __VA_ARGS__); break;  \
+    }
+
+#define DISPATCH_RESULT(result, buffer, kernel, ...)                                          \
+    switch ((buffer)->type) {                                                                  \
+        case BUFFER_FLOAT64: result = kernel##_float64((double*)(buffer)->data, __VA_ARGS__); break; \
+        case BUFFER_FLOAT32: result = kernel##_float32((float*)(buffer)->data, __VA_ARGS__); break;  \
+        case BUFFER_INT32:   result = kernel##_int32((int32_t*)(buffer)->data, __VA_ARGS__); break;  \
+        case BUFFER_UINT8:   result = kernel##_uint8((uint8_t*)(buffer)->data, __VA_ARGS__); break;  \
+    }
+
+bool l_buffer_type_from_name(const char* name, int length, BufferType* type) {
+    for (int i = BUFFER_FLOAT64; i <= BUFFER_UINT8; i++) {
+        if ((int)strlen(buffer_type_to_string[i]) == length &&
+            memcmp(buffer_type_to_string[i], name, length) == 0) {
+            *type = (BufferType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+double l_buffer_get(obj_buffer_t* buffer, int index) {
+    switch (buffer->type) {
+        case BUFFER_FLOAT64: return ((double*)buffer->data)[index];
+        case BUFFER_FLOAT32: return ((float*)buffer->data)[index];
+        case BUFFER_INT32:   return ((int32_t*)buffer->data)[index];
+        case BUFFER_UINT8:   return ((uint8_t*)buffer->data)[index];
+    }
+    return 0;
+}
+
+void l_buffer_set(obj_buffer_t* buffer, int index, double value) {
+    switch (buffer->type) {
+        case BUFFER_FLOAT64: ((double*)buffer->data)[index] = CONVERT_FLOAT64(value); break;
+        case BUFFER_FLOAT32: ((float*)buffer->data)[index] = CONVERT_FLOAT32(value); break;
+        case BUFFER_INT32:   ((int32_t*)buffer->data)[index] = CONVERT_INT32(value); break;
+        case BUFFER_UINT8:   ((uint8_t*)buffer->data)[index] = CONVERT_UINT8(value); break;
+    }
+}
+
+void l_buffer_fill(obj_buffer_t* buffer, double value) {
+    DISPATCH(buffer, _fill, buffer->count, value);
+}
+
+double l_buffer_sum(obj_buffer_t* buffer) {
+    double result = 0;
+    DISPATCH_RESULT(result, buffer, _sum, buffer->count);
+    return result;
+}
+
+double l_buffer_min(obj_buffer_t* buffer) {
+    if (buffer->count == 0)
+        return NAN;
+    double result = 0;
+    DISPATCH_RESULT(result, buffer, _min, buffer->count);
+    return result;
+}
+
+double l_buffer_max(obj_buffer_t* buffer) {
+    if (buffer->count == 0)
+        return NAN;
+    double result = 0;
+    DISPATCH_RESULT(result, buffer, _max, buffer->count);
+    return result;
+}
+
+void l_buffer_scale(obj_buffer_t* buffer, double factor) {
+    DISPATCH(buffer, _scale, buffer->count, factor);
+}
+
+int l_buffer_copy(obj_buffer_t* to, obj_buffer_t* from) {
+    int count = to->count < from->count ? to->count : from->count;
+
+    if (to->type == from->type) {
+        memmove(to->data, from->data, buffer_element_size[to->type] * count);
+        return count;
+    }
+
+    for (int i = 0; i < count; i++) {
+        l_buffer_set(to, i, l_buffer_get(from, i));
+    }
+    return count;
+}
+
+#undef DISPATCH
+#undef DISPATCH_RESULT
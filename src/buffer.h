@@ -0,0 +1,20 @@
+#ifndef LOX_BUFFER_H
+#define LOX_BUFFER_H
+
+#include "common.h"
+#include "object.h"
+
+bool l_buffer_type_from_name(const char* name, int length, BufferType* type);
+
+double l_buffer_get(obj_buffer_t* buffer, int index);
+void   l_buffer_set(obj_buffer_t* buffer, int index, double value);
+
+// bulk operations
+void   l_buffer_fill(obj_buffer_t* buffer, double value);
+double l_buffer_sum(obj_buffer_t* buffer);
+double l_buffer_min(obj_buffer_t* buffer);
+double l_buffer_max(obj_buffer_t* buffer);
+void   l_buffer_scale(obj_buffer_t* buffer, double factor);
+int    l_buffer_copy(obj_buffer_t* to, obj_buffer_t* from);
+
+#endif
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 
 #include "chunk.h"
+#include "object.h"
 #include "vm.h"
 #include "lib/memory.h"
 
@@ -9,12 +10,17 @@ void l_init_chunk(chunk_t* chunk) {
     chunk->capacity = 0;
     chunk->code     = NULL;
     chunk->lines    = NULL;
+    chunk->line_count    = 0;
+    chunk->line_capacity = 0;
+    chunk->mapped   = false;
     l_init_value_array(&chunk->constants);
 }
 
 void l_free_chunk(chunk_t* chunk) {
-    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    if (!chunk->mapped) {
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(line_start_t, chunk->lines, chunk->line_capacity);
+    }
     l_init_chunk(chunk);
 }
 
@@ -25,11 +31,22 @@ void l_write_chunk(chunk_t* chunk, uint8_t byte, int line)
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
+
+    if (chunk->line_count == 0 || chunk->lines[chunk->line_count - 1].line != line) {
+        if (chunk->line_capacity < chunk->line_count + 1) {
+            int oldCapacity = chunk->line_capacity;
+            chunk->line_capacity = GROW_CAPACITY(oldCapacity);
+            chunk->lines = GROW_ARRAY(line_start_t, chunk->lines, oldCapacity, chunk->line_capacity);
+        }
+
+        line_start_t* start = &chunk->lines[chunk->line_count++];
+        start->offset = chunk->count;
+        start->line = line;
+    }
+
     chunk->count++;
 }
 
@@ -39,4 +56,71 @@ int l_add_constant(chunk_t* chunk, value_t value) {
     l_pop();
     // return the index of the new constant
     return chunk->constants.count - 1;
+}
+
+int l_get_line(chunk_t* chunk, int offset) {
+    // the last run starting at or before offset
+    int low = 0;
+    int high = chunk->line_count - 1;
+    int line = 0;
+    while (low <= high) {
+        int mid = low + (high - low) / 2;
+        if (chunk->lines[mid].offset <= offset) {
+            line = chunk->lines[mid].line;
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return line;
+}
+
+void l_truncate_chunk(chunk_t* chunk, int count) {
+    chunk->count = count;
+    while (chunk->line_count > 0 && chunk->lines[chunk->line_count - 1].offset >= count) {
+        chunk->line_count--;
+    }
+}
+
+int l_instruction_length(chunk_t* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_BUILD_LIST:
+        case OP_BUILD_MAP:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_INVOKE:
+        case OP_TAIL_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 3;
+        case OP_BINARY_LL:
+        case OP_BINARY_LK:
+            return 4;
+        case OP_STORE_BINARY_LL:
+        case OP_STORE_BINARY_LK:
+            return 5;
+        case OP_CLOSURE: {
+            uint8_t constant = chunk->code[offset + 1];
+            obj_function_t* function = AS_FUNCTION(chunk->constants.values[constant]);
+            return 2 + function->upvalue_count * 2;
+        }
+        default:
+            return 1;
+    }
 }
\ No newline at end of file
@@ -42,14 +42,43 @@ typedef enum {
     OP_CLASS,
     OP_INHERIT,
     OP_METHOD,
+    OP_BUILD_LIST,
+    OP_BUILD_MAP,
+    OP_GET_INDEX,
+    OP_SET_INDEX,
+    OP_TAIL_CALL,
+    OP_TAIL_INVOKE,
+
+    // register forms emitted by the optimizer, operands address frame
+    // slots (L) or constants (K) directly and the first operand is the
+    // arithmetic or comparison opcode to apply
+    OP_BINARY_LL,
+    OP_BINARY_LK,
+    OP_STORE_BINARY_LL,
+    OP_STORE_BINARY_LK,
+
+    // written over the first byte of each instruction while coverage is
+    // recorded, the original opcode is put back the first time it runs
+    OP_COVERAGE,
 } OpCode;
 
+// The line table is run-length encoded, an entry is only added when the
+// line changes and covers the bytes up to the next entry's offset.
+typedef struct {
+    int offset; // first byte of the run
+    int line;
+} line_start_t;
+
 typedef struct {
     int      count;
     int      capacity;
     uint8_t* code;
-    int*     lines;
+    line_start_t* lines;
+    int      line_count;
+    int      line_capacity;
     value_array_t constants;
+    // code and lines point into a mapped bytecode image and aren't owned
+    bool     mapped;
 } chunk_t;
 
 void l_init_chunk(chunk_t* chunk);
@@ -58,4 +87,12 @@ void l_free_chunk(chunk_t* chunk);
 void l_write_chunk(chunk_t* chunk, uint8_t byte, int line);
 int  l_add_constant(chunk_t* chunk, value_t value);
 
+// source line of the byte at offset
+int  l_get_line(chunk_t* chunk, int offset);
+// drops the code from count onwards along with its line entries
+void l_truncate_chunk(chunk_t* chunk, int count);
+
+// number of bytes used by the instruction at offset, including operands
+int  l_instruction_length(chunk_t* chunk, int offset);
+
 #endif
\ No newline at end of file
@@ -12,6 +12,26 @@
 // #define DEBUG_STRESS_GC
 // #define DEBUG_LOG_GC
 
+// counts executed opcodes and opcode pairs, reported when the VM is freed
+// #define DEBUG_OPCODE_STATS
+// samples the cycles spent in each opcode, needs DEBUG_OPCODE_STATS
+// #define DEBUG_OPCODE_CYCLES
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
+// native code generation is only available for x86-64 linux
+#if defined(LOX_LINUX) && defined(__x86_64__)
+#define LOX_JIT
+#endif
+
+// the sampling profiler needs POSIX interval timers
+#if defined(LOX_LINUX) || defined(LOX_MACOS)
+#define LOX_PROFILER
+#endif
+
+// hardware performance counters come from linux's perf_event_open
+#if defined(LOX_LINUX)
+#define LOX_PERF
+#endif
+
 #endif
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,7 +6,10 @@
 #include "compiler.h"
 
 #include "common.h"
+#include "inliner.h"
+#include "optimizer.h"
 #include "scanner.h"
+#include "timeline.h"
 #include "lib/memory.h"
 
 #ifdef DEBUG_PRINT_CODE
@@ -69,6 +73,18 @@ typedef struct compiler_t {
     int       local_count;
     upvalue_t upvalues[UINT8_COUNT];
     int       scope_depth;    
+
+    // interned string -> constant index, so that repeated identifiers
+    // and string literals share a single constant slot
+    table_t   string_constants;
+
+    // constant folding state
+    int       operand_start;    // start of the left operand of the current infix
+    int       numeric_end;      // end of the last instruction known to push a number
+    int       last_jump_target; // most recent offset a jump was patched to
+
+    // offset of the last OP_CALL or OP_INVOKE, used to spot tail calls
+    int       last_call;
 } compiler_t;
 
 typedef struct class_compiler_t class_compiler_t;
@@ -194,6 +210,18 @@ static uint8_t _make_constant(value_t value) {
     return (uint8_t)constant;
 }
 
+static uint8_t _string_constant(const char* chars, int length) {
+    obj_string_t* string = l_copy_interned_string(chars, length);
+
+    value_t index;
+    if (l_table_get(&_current->string_constants, string, &index))
+        return (uint8_t)AS_NUMBER(index);
+
+    uint8_t constant = _make_constant(OBJ_VAL(string));
+    l_table_set(&_current->string_constants, string, NUMBER_VAL(constant));
+    return constant;
+}
+
 static void _emit_constant(value_t value) {
     _emit_bytes(OP_CONSTANT, _make_constant(value));
 }
@@ -208,6 +236,184 @@ static void _patch_jump(int offset) {
 
     _current_chunk()->code[offset] = (jump >> 8) & 0xff;
     _current_chunk()->code[offset + 1] = jump & 0xff;
+    _current->last_jump_target = _current_chunk()->count;
+}
+
+// Constant folding
+//
+// The compiler is single pass, so folding works on the code that has just
+// been emitted for an operand. An operand is constant when the code between
+// its start and end offsets is exactly one instruction that pushes a
+// constant. Folding only happens when the operand types are valid for the
+// operator, anything else is left for the VM to report at runtime.
+
+static bool _constant_operand(int start, int end, value_t* value) {
+    chunk_t* chunk = _current_chunk();
+
+    if (end - start == 1) {
+        switch (chunk->code[start]) {
+            case OP_NIL:   *value = NIL_VAL; return true;
+            case OP_TRUE:  *value = BOOL_VAL(true); return true;
+            case OP_FALSE: *value = BOOL_VAL(false); return true;
+            default:
+                return false;
+        }
+    }
+
+    if (end - start == 2 && chunk->code[start] == OP_CONSTANT) {
+        *value = chunk->constants.values[chunk->code[start + 1]];
+        return true;
+    }
+
+    return false;
+}
+
+// An operand is known to be a number when it is a number constant or when
+// it ends with an instruction that always pushes a number and nothing
+// jumps to its end (so that instruction produced the operand's value).
+static bool _numeric_operand(int start, int end) {
+    value_t value;
+    if (_constant_operand(start, end, &value))
+        return IS_NUMBER(value);
+
+    return _current->numeric_end == end && _current->last_jump_target != end;
+}
+
+// Number constants are never shared, so a folded operand's number constant
+// can be dropped when it is the last one in the pool.
+static void _release_operand(int start, int end) {
+    chunk_t* chunk = _current_chunk();
+    if (end - start != 2 || chunk->code[start] != OP_CONSTANT)
+        return;
+
+    int constant = chunk->code[start + 1];
+    if (constant == chunk->constants.count - 1 && 
+        IS_NUMBER(chunk->constants.values[constant])) {
+        chunk->constants.count--;
+    }
+}
+
+static void _truncate_code(int offset) {
+    l_truncate_chunk(_current_chunk(), offset);
+    _current->numeric_end = -1;
+}
+
+static bool _is_falsey_constant(value_t value) {
+    return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static void _emit_folded(value_t value) {
+    if (IS_NIL(value)) {
+        _emit_byte(OP_NIL);
+    } else if (IS_BOOL(value)) {
+        _emit_byte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    } else if (IS_STRING(value)) {
+        obj_string_t* string = AS_STRING(value);
+        _emit_bytes(OP_CONSTANT, _string_constant(string->chars, string->length));
+    } else {
+        _emit_constant(value);
+        _current->numeric_end = _current_chunk()->count;
+    }
+}
+
+static bool _fold_binary(TokenType operatorType, int leftStart, int rightStart, int end) {
+    value_t a, b;
+    if (!_constant_operand(leftStart, rightStart, &a) || 
+        !_constant_operand(rightStart, end, &b)) {
+        return false;
+    }
+
+    value_t result;
+    if (operatorType == TOKEN_EQUAL_EQUAL || operatorType == TOKEN_BANG_EQUAL) {
+        bool equal = l_values_equal(a, b);
+        result = BOOL_VAL(operatorType == TOKEN_EQUAL_EQUAL ? equal : !equal);
+    } 
+    else if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+        obj_string_t* left = AS_STRING(a);
+        obj_string_t* right = AS_STRING(b);
+        int length = left->length + right->length;
+        char* chars = ALLOCATE(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+
+        _truncate_code(leftStart);
+        _emit_bytes(OP_CONSTANT, _string_constant(chars, length));
+        FREE_ARRAY(char, chars, length + 1);
+        return true;
+    } 
+    else if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        double x = AS_NUMBER(a);
+        double y = AS_NUMBER(b);
+        switch (operatorType) {
+            case TOKEN_GREATER:       result = BOOL_VAL(x > y); break;
+            case TOKEN_GREATER_EQUAL: result = BOOL_VAL(!(x < y)); break;
+            case TOKEN_LESS:          result = BOOL_VAL(x < y); break;
+            case TOKEN_LESS_EQUAL:    result = BOOL_VAL(!(x > y)); break;
+            case TOKEN_PLUS:          result = NUMBER_VAL(x + y); break;
+            case TOKEN_MINUS:         result = NUMBER_VAL(x - y); break;
+            case TOKEN_STAR:          result = NUMBER_VAL(x * y); break;
+            case TOKEN_SLASH:         result = NUMBER_VAL(x / y); break;
+            default:
+                return false;
+        }
+    } 
+    else {
+        return false;
+    }
+
+    _release_operand(rightStart, end);
+    _release_operand(leftStart, rightStart);
+    _truncate_code(leftStart);
+    _emit_folded(result);
+    return true;
+}
+
+// x * 1, x / 1 and x - 0 are replaced by x when x is known to be a number.
+// They can't be applied to unknown operands as the operator would raise
+// an error for non-numbers.
+static bool _fold_identity(TokenType operatorType, bool leftNumeric, int rightStart, int end) {
+    value_t b;
+    if (!leftNumeric || !_constant_operand(rightStart, end, &b) || !IS_NUMBER(b))
+        return false;
+
+    double y = AS_NUMBER(b);
+    bool identity = false;
+    switch (operatorType) {
+        case TOKEN_STAR:  identity = y == 1; break;
+        case TOKEN_SLASH: identity = y == 1; break;
+        case TOKEN_MINUS: identity = y == 0 && !signbit(y); break;
+        default:
+            break;
+    }
+
+    if (!identity)
+        return false;
+
+    _release_operand(rightStart, end);
+    _truncate_code(rightStart);
+    _current->numeric_end = rightStart;
+    return true;
+}
+
+static bool _fold_unary(TokenType operatorType, int start, int end) {
+    value_t value;
+    if (!_constant_operand(start, end, &value))
+        return false;
+
+    value_t result;
+    if (operatorType == TOKEN_BANG) {
+        result = BOOL_VAL(_is_falsey_constant(value));
+    } else if (operatorType == TOKEN_MINUS && IS_NUMBER(value)) {
+        result = NUMBER_VAL(-AS_NUMBER(value));
+    } else {
+        return false;
+    }
+
+    _release_operand(start, end);
+    _truncate_code(start);
+    _emit_folded(result);
+    return true;
 }
 
 static void l_init_compiler(compiler_t* compiler, FunctionType type) {
@@ -220,6 +426,12 @@ static void l_init_compiler(compiler_t* compiler, FunctionType type) {
 
     compiler->local_count = 0;
     compiler->scope_depth = 0;
+    l_init_table(&compiler->string_constants);
+
+    compiler->operand_start = 0;
+    compiler->numeric_end = -1;
+    compiler->last_jump_target = -1;
+    compiler->last_call = -1;
 
     compiler->function = l_new_function();
 
@@ -247,6 +459,15 @@ static void l_init_compiler(compiler_t* compiler, FunctionType type) {
 static obj_function_t* _end_compiler() {
     _emit_return();
     obj_function_t* function = _current->function;
+    l_free_table(&_current->string_constants);
+
+    if (!_parser.had_error && l_get_optimize_level() > 0)
+        l_optimize_function(function);
+
+    // the script itself always runs in a frame
+    if (!_parser.had_error && _current->type != TYPE_SCRIPT)
+        l_analyze_inline(function);
+
 #ifdef DEBUG_PRINT_CODE
     if (!_parser.had_error) {
         l_dissassemble_chunk(
@@ -284,8 +505,7 @@ static parse_rule_t* _get_rule(TokenType type);
 static void          _parse_precedence(Precedence precedence);
 
 static uint8_t _identifier_constant(token_t* name) {
-    return _make_constant(OBJ_VAL(l_copy_string(name->start,
-                                                name->length)));
+    return _string_constant(name->start, name->length);
 }
 
 static bool _identifiers_equal(token_t* a, token_t* b) {
@@ -426,9 +646,20 @@ static void _and_(bool canAssign) {
 
 static void _binary(bool canAssign) {
     TokenType operatorType = _parser.previous.type;
+    int leftStart = _current->operand_start;
+    int rightStart = _current_chunk()->count;
+    bool leftNumeric = _numeric_operand(leftStart, rightStart);
+
     parse_rule_t* rule = _get_rule(operatorType);
     _parse_precedence((Precedence)(rule->precedence + 1));
 
+    int end = _current_chunk()->count;
+    if (_fold_binary(operatorType, leftStart, rightStart, end) ||
+        _fold_identity(operatorType, leftNumeric, rightStart, end)) {
+        return;
+    }
+    bool rightNumeric = _numeric_operand(rightStart, end);
+
     switch (operatorType) {
         case TOKEN_BANG_EQUAL:    _emit_bytes(OP_EQUAL, OP_NOT); break;
         case TOKEN_EQUAL_EQUAL:   _emit_byte(OP_EQUAL); break;
@@ -443,10 +674,19 @@ static void _binary(bool canAssign) {
         default: 
             return; // Unreachable.
     }
+
+    // arithmetic either pushes a number or raises a runtime error
+    if (operatorType == TOKEN_MINUS || 
+        operatorType == TOKEN_STAR || 
+        operatorType == TOKEN_SLASH ||
+        (operatorType == TOKEN_PLUS && leftNumeric && rightNumeric)) {
+        _current->numeric_end = _current_chunk()->count;
+    }
 }
 
 static void _call(bool canAssign) {
     uint8_t argCount = _argument_list();
+    _current->last_call = _current_chunk()->count;
     _emit_bytes(OP_CALL, argCount);
 }
 
@@ -459,6 +699,7 @@ static void _dot(bool canAssign) {
         _emit_bytes(OP_SET_PROPERTY, name);
     } else if ( _match(TOKEN_LEFT_PAREN) ) {
         uint8_t argCount = _argument_list();
+        _current->last_call = _current_chunk()->count;
         _emit_bytes(OP_INVOKE, name);
         _emit_byte(argCount);
     } else {
@@ -466,6 +707,50 @@ static void _dot(bool canAssign) {
     }
 }
 
+static void _index(bool canAssign) {
+    _expression();
+    _consume(TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (canAssign && _match(TOKEN_EQUAL)) {
+        _expression();
+        _emit_byte(OP_SET_INDEX);
+    } else {
+        _emit_byte(OP_GET_INDEX);
+    }
+}
+
+static void _list(bool canAssign) {
+    uint8_t itemCount = 0;
+    if (!_check(TOKEN_RIGHT_BRACKET)) {
+        do {
+            _expression();
+            if (itemCount == 255) {
+                _error("Can't have more than 255 items in a list literal.");
+            }
+            itemCount++;
+        } while (_match(TOKEN_COMMA));
+    }
+    _consume(TOKEN_RIGHT_BRACKET, "Expect ']' after list items.");
+    _emit_bytes(OP_BUILD_LIST, itemCount);
+}
+
+static void _map(bool canAssign) {
+    uint8_t entryCount = 0;
+    if (!_check(TOKEN_RIGHT_BRACE)) {
+        do {
+            _expression();
+            _consume(TOKEN_COLON, "Expect ':' after map key.");
+            _expression();
+            if (entryCount == 255) {
+                _error("Can't have more than 255 entries in a map literal.");
+            }
+            entryCount++;
+        } while (_match(TOKEN_COMMA));
+    }
+    _consume(TOKEN_RIGHT_BRACE, "Expect '}' after map entries.");
+    _emit_bytes(OP_BUILD_MAP, entryCount);
+}
+
 static void _literal(bool canAssign) {
     switch (_parser.previous.type) {
         case TOKEN_FALSE: _emit_byte(OP_FALSE); break;
@@ -484,6 +769,7 @@ static void _grouping(bool canAssign) {
 static void _number(bool canAssign) {
     double number = strtod(_parser.previous.start, NULL);
     _emit_constant(NUMBER_VAL(number));
+    _current->numeric_end = _current_chunk()->count;
 }
 
 static void _or_(bool canAssign) {
@@ -498,12 +784,9 @@ static void _or_(bool canAssign) {
 }
 
 static void _string(bool canAssign) {
-    _emit_constant(
-        OBJ_VAL(
-            l_copy_string(_parser.previous.start  + 1,
-                          _parser.previous.length - 2)
-        )
-    );
+    uint8_t constant = _string_constant(_parser.previous.start  + 1,
+                                        _parser.previous.length - 2);
+    _emit_bytes(OP_CONSTANT, constant);
 }
 
 static void _named_variable(token_t name, bool canAssign) {
@@ -573,14 +856,21 @@ static void _this_(bool canAssign) {
 
 static void _unary(bool canAssign) {
     TokenType operatorType = _parser.previous.type;
+    int start = _current_chunk()->count;
 
     // Compile the operand.
     _parse_precedence(PREC_UNARY);
 
+    if (_fold_unary(operatorType, start, _current_chunk()->count))
+        return;
+
     // Emit the operator instruction.
     switch (operatorType) {
         case TOKEN_BANG:  _emit_byte(OP_NOT); break;
-        case TOKEN_MINUS: _emit_byte(OP_NEGATE); break;
+        case TOKEN_MINUS: 
+            _emit_byte(OP_NEGATE); 
+            _current->numeric_end = _current_chunk()->count;
+            break;
         default: 
             return; // Unreachable.
     }
@@ -589,8 +879,11 @@ static void _unary(bool canAssign) {
 parse_rule_t rules[] = {
     [TOKEN_LEFT_PAREN]    = {_grouping, _call,    PREC_CALL},
     [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,     PREC_NONE},
-    [TOKEN_LEFT_BRACE]    = {NULL,     NULL,     PREC_NONE}, 
+    [TOKEN_LEFT_BRACE]    = {_map,     NULL,     PREC_NONE}, 
     [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_LEFT_BRACKET]  = {_list,    _index,   PREC_CALL},
+    [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,     PREC_NONE},
+    [TOKEN_COLON]         = {NULL,     NULL,     PREC_NONE},
     [TOKEN_COMMA]         = {NULL,     NULL,     PREC_NONE},
     [TOKEN_DOT]           = {NULL,     _dot,     PREC_CALL},
     [TOKEN_MINUS]         = {_unary,   _binary,  PREC_TERM},
@@ -639,11 +932,13 @@ static void _parse_precedence(Precedence precedence) {
     }
 
     bool canAssign = precedence <= PREC_ASSIGNMENT;
+    int operandStart = _current_chunk()->count;
     prefixRule(canAssign);
 
     while (precedence <= _get_rule(_parser.current.type)->precedence) {
         _advance();
         parse_func infixRule = _get_rule(_parser.previous.type)->infix;
+        _current->operand_start = operandStart;
         infixRule(canAssign);
     }
 
@@ -886,6 +1181,15 @@ static void _return_statement() {
         }
         _expression();
         _consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // a call that produces the return value can reuse this frame,
+        // the OP_RETURN is kept for callees that don't replace the frame
+        chunk_t* chunk = _current_chunk();
+        int call = _current->last_call;
+        if (call >= 0 && call + l_instruction_length(chunk, call) == chunk->count) {
+            chunk->code[call] = chunk->code[call] == OP_CALL ? OP_TAIL_CALL
+                                                             : OP_TAIL_INVOKE;
+        }
         _emit_byte(OP_RETURN);
     }
 }
@@ -971,6 +1275,7 @@ static void _statement() {
 
 
 obj_function_t* l_compile(const char* source) {
+    TIMELINE_BEGIN(TIMELINE_COMPILE, "compile");
     l_init_scanner(source);
     compiler_t compiler;
 
@@ -987,6 +1292,7 @@ obj_function_t* l_compile(const char* source) {
 
     obj_function_t* function = _end_compiler();
 
+    TIMELINE_END(TIMELINE_COMPILE);
     return _parser.had_error ? NULL : function;    
 }
 
@@ -994,6 +1300,7 @@ void l_mark_compiler_roots() {
     compiler_t* compiler = _current;
     while (compiler != NULL) {
         l_mark_object((obj_t*)compiler->function);
+        l_mark_table(&compiler->string_constants);
         compiler = compiler->enclosing;
     }
 }
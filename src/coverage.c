@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "coverage.h"
+#include "jit.h"
+#include "lib/memory.h"
+
+typedef enum {
+    COVERAGE_NONE,     // an operand byte
+    COVERAGE_PATCHED,  // an instruction that hasn't run
+    COVERAGE_HIT,
+} CoverageState;
+
+struct coverage_t {
+    obj_function_t* function;  // NULL once the function has been freed
+    char*           name;      // "name:line" of its first instruction
+    int             count;
+    uint8_t*        original;  // the code before it was patched
+    uint8_t*        state;     // a CoverageState for each byte of code
+    int*            lines;     // the source line of each instruction
+    coverage_t*     next;
+};
+
+static struct {
+    bool        enabled;
+    const char* path;
+    const char* source;
+    coverage_t* first;
+    coverage_t* last;
+} _coverage;
+
+bool l_start_coverage(const char* path, const char* source) {
+    if (_coverage.enabled)
+        return false;
+
+#ifdef LOX_JIT
+    // native code is compiled from the code as it is, patched or not
+    l_set_jit_enabled(false);
+#endif
+
+    _coverage.enabled = true;
+    _coverage.path = path;
+    _coverage.source = source;
+    _coverage.first = NULL;
+    _coverage.last = NULL;
+    return true;
+}
+
+bool l_coverage_enabled() {
+    return _coverage.enabled;
+}
+
+// takes a copy of code mapped from a bytecode image, which is read only
+static void _own_chunk(chunk_t* chunk) {
+    uint8_t* code = ALLOCATE(uint8_t, chunk->count);
+    memcpy(code, chunk->code, chunk->count);
+    line_start_t* lines = ALLOCATE(line_start_t, chunk->line_count);
+    memcpy(lines, chunk->lines, sizeof(line_start_t) * chunk->line_count);
+
+    chunk->code = code;
+    chunk->capacity = chunk->count;
+    chunk->lines = lines;
+    chunk->line_capacity = chunk->line_count;
+    chunk->mapped = false;
+}
+
+void l_coverage_patch(obj_function_t* function) {
+    chunk_t* chunk = &function->chunk;
+    if (!_coverage.enabled || function->coverage != NULL || chunk->count == 0)
+        return;
+
+    if (chunk->mapped)
+        _own_chunk(chunk);
+
+    coverage_t* coverage = malloc(sizeof(coverage_t));
+    coverage->function = function;
+    coverage->count = chunk->count;
+    coverage->original = malloc(chunk->count);
+    coverage->state = calloc(chunk->count, sizeof(uint8_t));
+    coverage->lines = malloc(sizeof(int) * chunk->count);
+    coverage->next = NULL;
+    memcpy(coverage->original, chunk->code, chunk->count);
+
+    const char* name = function->name == NULL ? "script" : function->name->chars;
+    int length = snprintf(NULL, 0, "%s:%d", name, l_get_line(chunk, 0));
+    coverage->name = malloc(length + 1);
+    snprintf(coverage->name, length + 1, "%s:%d", name, l_get_line(chunk, 0));
+
+    // instruction lengths are read from the original code before any of it
+    // is patched
+    for (int offset = 0; offset < chunk->count; offset += l_instruction_length(chunk, offset)) {
+        coverage->state[offset] = COVERAGE_PATCHED;
+        coverage->lines[offset] = l_get_line(chunk, offset);
+    }
+    for (int offset = 0; offset < chunk->count; offset++) {
+        if (coverage->state[offset] == COVERAGE_PATCHED)
+            chunk->code[offset] = OP_COVERAGE;
+    }
+
+    function->coverage = coverage;
+    // an inlined call evaluates the function without running its code
+    function->inline_kind = INLINE_NONE;
+
+    if (_coverage.last == NULL)
+        _coverage.first = coverage;
+    else
+        _coverage.last->next = coverage;
+    _coverage.last = coverage;
+
+    for (int i = 0; i < chunk->constants.count; i++) {
+        value_t constant = chunk->constants.values[i];
+        if (IS_FUNCTION(constant))
+            l_coverage_patch(AS_FUNCTION(constant));
+    }
+}
+
+void l_coverage_hit(obj_function_t* function, int offset) {
+    coverage_t* coverage = function->coverage;
+    coverage->state[offset] = COVERAGE_HIT;
+    function->chunk.code[offset] = coverage->original[offset];
+}
+
+void l_coverage_free_function(obj_function_t* function) {
+    if (function->coverage != NULL)
+        function->coverage->function = NULL;
+}
+
+static void _write_report(FILE* file) {
+    int lineCount = 0;
+    for (coverage_t* coverage = _coverage.first; coverage != NULL; coverage = coverage->next) {
+        for (int offset = 0; offset < coverage->count; offset++) {
+            if (coverage->state[offset] != COVERAGE_NONE && coverage->lines[offset] >= lineCount)
+                lineCount = coverage->lines[offset] + 1;
+        }
+    }
+
+    // per line, 0 for no code, 1 for code that didn't run and 2 for code that did
+    uint8_t* lines = calloc(lineCount > 0 ? lineCount : 1, sizeof(uint8_t));
+
+    fprintf(file, "TN:\nSF:%s\n", _coverage.source);
+
+    int functionsHit = 0;
+    int functionCount = 0;
+    for (coverage_t* coverage = _coverage.first; coverage != NULL; coverage = coverage->next) {
+        fprintf(file, "FN:%d,%s\n", coverage->lines[0], coverage->name);
+    }
+    for (coverage_t* coverage = _coverage.first; coverage != NULL; coverage = coverage->next) {
+        bool hit = coverage->state[0] == COVERAGE_HIT;
+        fprintf(file, "FNDA:%d,%s\n", hit ? 1 : 0, coverage->name);
+        functionsHit += hit;
+        functionCount++;
+
+        for (int offset = 0; offset < coverage->count; offset++) {
+            uint8_t state = coverage->state[offset];
+            if (state == COVERAGE_NONE)
+                continue;
+
+            int line = coverage->lines[offset];
+            uint8_t seen = state == COVERAGE_HIT ? 2 : 1;
+            if (lines[line] < seen)
+                lines[line] = seen;
+        }
+    }
+    fprintf(file, "FNF:%d\nFNH:%d\n", functionCount, functionsHit);
+
+    int linesFound = 0;
+    int linesHit = 0;
+    for (int line = 0; line < lineCount; line++) {
+        if (lines[line] == 0)
+            continue;
+
+        fprintf(file, "DA:%d,%d\n", line, lines[line] == 2 ? 1 : 0);
+        linesFound++;
+        linesHit += lines[line] == 2;
+    }
+    fprintf(file, "LF:%d\nLH:%d\nend_of_record\n", linesFound, linesHit);
+
+    free(lines);
+}
+
+void l_stop_coverage() {
+    if (!_coverage.enabled)
+        return;
+    _coverage.enabled = false;
+
+    FILE* file = fopen(_coverage.path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", _coverage.path);
+    } else {
+        _write_report(file);
+        fclose(file);
+    }
+
+    coverage_t* coverage = _coverage.first;
+    while (coverage != NULL) {
+        coverage_t* next = coverage->next;
+
+        obj_function_t* function = coverage->function;
+        if (function != NULL) {
+            for (int offset = 0; offset < coverage->count; offset++) {
+                if (coverage->state[offset] == COVERAGE_PATCHED)
+                    function->chunk.code[offset] = coverage->original[offset];
+            }
+            function->coverage = NULL;
+        }
+
+        free(coverage->name);
+        free(coverage->original);
+        free(coverage->state);
+        free(coverage->lines);
+        free(coverage);
+        coverage = next;
+    }
+    memset(&_coverage, 0, sizeof(_coverage));
+}
@@ -0,0 +1,31 @@
+#ifndef LOX_COVERAGE_H
+#define LOX_COVERAGE_H
+
+#include "common.h"
+#include "object.h"
+
+// Starts recording which instructions run. Each script run afterwards has
+// the first byte of every instruction in it and in the functions it
+// defines replaced with OP_COVERAGE. The first time one runs the VM
+// records it and puts the original opcode back, so code that has run
+// costs nothing more. Bytecode mapped from a file is copied before it's
+// patched. Inlined calls and the JIT are turned off, as both need the
+// original code. source is the script's path, used in the report.
+bool l_start_coverage(const char* path, const char* source);
+
+// Writes the lines and functions that ran to the path given to
+// l_start_coverage as an lcov tracefile, which genhtml and most editors
+// read. A line's count is 1 when any of its instructions ran. Functions
+// still patched get their original code back.
+void l_stop_coverage();
+
+bool l_coverage_enabled();
+
+// patches function and the functions in its constants that aren't yet
+void l_coverage_patch(obj_function_t* function);
+// records the OP_COVERAGE at offset and restores its opcode
+void l_coverage_hit(obj_function_t* function, int offset);
+// called when a patched function is freed, its lines are kept
+void l_coverage_free_function(obj_function_t* function);
+
+#endif
@@ -0,0 +1,117 @@
+#include "inliner.h"
+
+static bool _is_binary_operator(uint8_t op) {
+    switch (op) {
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool _matches(chunk_t* chunk, const int* pattern, int length) {
+    if (chunk->count < length)
+        return false;
+
+    for (int i = 0; i < length; i++) {
+        // negative entries accept any operand byte
+        if (pattern[i] >= 0 && chunk->code[i] != pattern[i])
+            return false;
+    }
+    return true;
+}
+
+static void _set_kind(obj_function_t* function, InlineKind kind, uint8_t op, uint8_t a, uint8_t b) {
+    function->inline_kind = kind;
+    function->inline_op = op;
+    function->inline_a = a;
+    function->inline_b = b;
+}
+
+static bool _analyze_setter(obj_function_t* function) {
+    chunk_t* chunk = &function->chunk;
+    uint8_t* code = chunk->code;
+
+    int stores = 0;
+    int offset = 0;
+    while (stores < UINT8_MAX &&
+           offset + INLINE_SETTER_STORE_LENGTH <= chunk->count &&
+           code[offset] == OP_GET_LOCAL && code[offset + 1] == 0 &&
+           code[offset + 2] == OP_GET_LOCAL &&
+           code[offset + 4] == OP_SET_PROPERTY &&
+           code[offset + 6] == OP_POP) {
+        stores++;
+        offset += INLINE_SETTER_STORE_LENGTH;
+    }
+
+    if (stores == 0)
+        return false;
+
+    // the implicit return of a method or an initializer
+    if (offset + 2 <= chunk->count &&
+        code[offset] == OP_NIL && code[offset + 1] == OP_RETURN) {
+        _set_kind(function, INLINE_SETTER, 0, stores, false);
+        return true;
+    }
+    if (offset + 3 <= chunk->count &&
+        code[offset] == OP_GET_LOCAL && code[offset + 1] == 0 &&
+        code[offset + 2] == OP_RETURN) {
+        _set_kind(function, INLINE_SETTER, 0, stores, true);
+        return true;
+    }
+    return false;
+}
+
+void l_analyze_inline(obj_function_t* function) {
+    chunk_t* chunk = &function->chunk;
+    uint8_t* code = chunk->code;
+
+    function->inline_kind = INLINE_NONE;
+    if (chunk->count == 0)
+        return;
+
+    // only the code up to the first OP_RETURN is matched, anything after
+    // it in a function without jumps is unreachable
+    static const int constant[]  = {OP_CONSTANT, -1, OP_RETURN};
+    static const int parameter[] = {OP_GET_LOCAL, -1, OP_RETURN};
+    static const int getter[]    = {OP_GET_LOCAL, 0, OP_GET_PROPERTY, -1, OP_RETURN};
+    static const int localLocal[]    = {OP_GET_LOCAL, -1, OP_GET_LOCAL, -1, -1, OP_RETURN};
+    static const int localConstant[] = {OP_GET_LOCAL, -1, OP_CONSTANT, -1, -1, OP_RETURN};
+    static const int registerLocal[]    = {OP_BINARY_LL, -1, -1, -1, OP_RETURN};
+    static const int registerConstant[] = {OP_BINARY_LK, -1, -1, -1, OP_RETURN};
+
+    if ((code[0] == OP_NIL || code[0] == OP_TRUE || code[0] == OP_FALSE) &&
+        chunk->count >= 2 && code[1] == OP_RETURN) {
+        _set_kind(function, INLINE_CONSTANT, code[0], 0, 0);
+    }
+    else if (_matches(chunk, constant, 3)) {
+        _set_kind(function, INLINE_CONSTANT, OP_CONSTANT, code[1], 0);
+    }
+    else if (_matches(chunk, parameter, 3)) {
+        _set_kind(function, INLINE_PARAMETER, 0, code[1], 0);
+    }
+    else if (_matches(chunk, getter, 5)) {
+        _set_kind(function, INLINE_GETTER, 0, code[3], 0);
+    }
+    else if (_matches(chunk, localLocal, 6) && _is_binary_operator(code[4])) {
+        _set_kind(function, INLINE_BINARY_LL, code[4], code[1], code[3]);
+    }
+    else if (_matches(chunk, localConstant, 6) && _is_binary_operator(code[4])) {
+        _set_kind(function, INLINE_BINARY_LK, code[4], code[1], code[3]);
+    }
+    else if (_matches(chunk, registerLocal, 5)) {
+        _set_kind(function, INLINE_BINARY_LL, code[1], code[2], code[3]);
+    }
+    else if (_matches(chunk, registerConstant, 5)) {
+        _set_kind(function, INLINE_BINARY_LK, code[1], code[2], code[3]);
+    }
+    else {
+        _analyze_setter(function);
+    }
+}
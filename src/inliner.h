@@ -0,0 +1,14 @@
+#ifndef LOX_INLINER_H
+#define LOX_INLINER_H
+
+#include "common.h"
+#include "object.h"
+
+// GET_LOCAL 0, GET_LOCAL slot, SET_PROPERTY name, POP
+#define INLINE_SETTER_STORE_LENGTH 7
+
+// Matches the function's bytecode against the leaf shapes in InlineKind
+// and records the result on the function for the VM's call path.
+void l_analyze_inline(obj_function_t* function);
+
+#endif
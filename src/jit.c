@@ -0,0 +1,1224 @@
+#include "jit.h"
+
+#ifdef LOX_JIT
+
+#include <string.h>
+#include <sys/mman.h>
+
+#include "lib/memory.h"
+#include "timeline.h"
+
+// A baseline JIT for x86-64. Each bytecode instruction is translated into
+// a fixed machine code template, the templates are laid out in bytecode
+// order so control flow between them maps directly onto native jumps.
+//
+// Register usage inside native code:
+//   rbx  &vm.stack_top
+//   r12  frame->slots
+//   r13  frame
+//   r14  cached stack top, written back to vm.stack_top on exit and
+//        before calling a helper that can allocate
+//   r15  constants of the function
+//
+// Operations with a type guard (arithmetic, comparisons) only handle
+// numbers. When a guard fails, or an instruction has no template, the
+// native code exits with the offset of the instruction and the interpreter
+// executes it, so the results and runtime errors are the interpreter's own.
+
+typedef enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} Register;
+
+typedef enum {
+    CC_B  = 0x2,
+    CC_E  = 0x4,
+    CC_NE = 0x5,
+    CC_A  = 0x7,
+    CC_NP = 0xb,
+} ConditionCode;
+
+#define VALUE_SIZE ((int)sizeof(value_t))
+#define VALUE_TYPE ((int)offsetof(value_t, type))
+#define VALUE_AS   ((int)offsetof(value_t, as))
+
+typedef struct {
+    int at;     // position of the rel32 operand
+    int offset; // bytecode offset it refers to
+} jit_fixup_t;
+
+typedef struct {
+    uint8_t*     code;
+    int          count;
+    int          capacity;
+
+    jit_fixup_t* jumps;
+    int          jump_count;
+    int          jump_capacity;
+
+    jit_fixup_t* exits;
+    int          exit_count;
+    int          exit_capacity;
+} jit_builder_t;
+
+typedef int (*jit_entry_t)(callframe_t* frame, const uint8_t* target);
+
+static bool _jit_enabled = false;
+
+void l_set_jit_enabled(bool enabled) {
+    _jit_enabled = enabled;
+}
+
+bool l_jit_enabled() {
+    return _jit_enabled;
+}
+
+// Emitter
+
+static void _emit(jit_builder_t* b, uint8_t byte) {
+    if (b->capacity < b->count + 1) {
+        int oldCapacity = b->capacity;
+        b->capacity = GROW_CAPACITY(oldCapacity);
+        b->code = GROW_ARRAY(uint8_t, b->code, oldCapacity, b->capacity);
+    }
+    b->code[b->count++] = byte;
+}
+
+static void _emit32(jit_builder_t* b, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        _emit(b, (value >> (i * 8)) & 0xff);
+    }
+}
+
+static void _emit64(jit_builder_t* b, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        _emit(b, (value >> (i * 8)) & 0xff);
+    }
+}
+
+static void _patch32(jit_builder_t* b, int at, int32_t value) {
+    memcpy(&b->code[at], &value, sizeof(value));
+}
+
+static void _add_fixup(jit_fixup_t** fixups, int* count, int* capacity, int at, int offset) {
+    if (*capacity < *count + 1) {
+        int oldCapacity = *capacity;
+        *capacity = GROW_CAPACITY(oldCapacity);
+        *fixups = GROW_ARRAY(jit_fixup_t, *fixups, oldCapacity, *capacity);
+    }
+    (*fixups)[*count].at = at;
+    (*fixups)[*count].offset = offset;
+    (*count)++;
+}
+
+// REX prefix, only emitted when one of its bits is needed
+static void _rex(jit_builder_t* b, bool wide, int reg, int base) {
+    uint8_t rex = 0x40 | (wide << 3) | ((reg & 8) >> 1) | ((base & 8) >> 3);
+    if (rex != 0x40)
+        _emit(b, rex);
+}
+
+// ModRM addressing [base + disp32]
+static void _memory(jit_builder_t* b, int reg, int base, int32_t disp) {
+    _emit(b, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP)
+        _emit(b, 0x24);
+    _emit32(b, (uint32_t)disp);
+}
+
+static void _push(jit_builder_t* b, int reg) {
+    _rex(b, false, 0, reg);
+    _emit(b, 0x50 + (reg & 7));
+}
+
+static void _pop(jit_builder_t* b, int reg) {
+    _rex(b, false, 0, reg);
+    _emit(b, 0x58 + (reg & 7));
+}
+
+// mov dst, [base + disp]
+static void _load(jit_builder_t* b, int dst, int base, int32_t disp) {
+    _rex(b, true, dst, base);
+    _emit(b, 0x8b);
+    _memory(b, dst, base, disp);
+}
+
+// mov [base + disp], src
+static void _store(jit_builder_t* b, int base, int32_t disp, int src) {
+    _rex(b, true, src, base);
+    _emit(b, 0x89);
+    _memory(b, src, base, disp);
+}
+
+// mov dst, src
+static void _move(jit_builder_t* b, int dst, int src) {
+    _rex(b, true, src, dst);
+    _emit(b, 0x89);
+    _emit(b, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// mov dst, imm64
+static void _move_imm(jit_builder_t* b, int dst, uint64_t value) {
+    _rex(b, true, 0, dst);
+    _emit(b, 0xb8 + (dst & 7));
+    _emit64(b, value);
+}
+
+// add dst, imm32
+static void _add_imm(jit_builder_t* b, int dst, int32_t value) {
+    _rex(b, true, 0, dst);
+    _emit(b, 0x81);
+    _emit(b, 0xc0 | (dst & 7));
+    _emit32(b, (uint32_t)value);
+}
+
+// mov dword [base + disp], imm32
+static void _store_type(jit_builder_t* b, int base, int32_t disp, ValueType type) {
+    _rex(b, false, 0, base);
+    _emit(b, 0xc7);
+    _memory(b, 0, base, disp + VALUE_TYPE);
+    _emit32(b, type);
+}
+
+// mov qword [base + disp], imm32
+static void _store_imm(jit_builder_t* b, int base, int32_t disp, int32_t value) {
+    _rex(b, true, 0, base);
+    _emit(b, 0xc7);
+    _memory(b, 0, base, disp);
+    _emit32(b, (uint32_t)value);
+}
+
+// cmp dword [base + disp], type
+static void _compare_type(jit_builder_t* b, int base, int32_t disp, ValueType type) {
+    _rex(b, false, 0, base);
+    _emit(b, 0x83);
+    _memory(b, 7, base, disp + VALUE_TYPE);
+    _emit(b, type);
+}
+
+// sse instructions operating on xmm and [base + disp]
+static void _sse(jit_builder_t* b, uint8_t prefix, uint8_t op, int xmm, int base, int32_t disp) {
+    _emit(b, prefix);
+    _rex(b, false, xmm, base);
+    _emit(b, 0x0f);
+    _emit(b, op);
+    _memory(b, xmm, base, disp);
+}
+
+#define MOVDQU_LOAD(b, base, disp)  _sse(b, 0xf3, 0x6f, 0, base, disp)
+#define MOVDQU_STORE(b, base, disp) _sse(b, 0xf3, 0x7f, 0, base, disp)
+#define MOVSD_LOAD(b, base, disp)   _sse(b, 0xf2, 0x10, 0, base, disp)
+#define MOVSD_STORE(b, base, disp)  _sse(b, 0xf2, 0x11, 0, base, disp)
+#define UCOMISD(b, base, disp)      _sse(b, 0x66, 0x2e, 0, base, disp)
+
+// jcc rel32 to a bytecode offset or exit stub, patched once known
+static void _jump_to(jit_builder_t* b, int cc, int offset) {
+    if (cc < 0) {
+        _emit(b, 0xe9);
+    } else {
+        _emit(b, 0x0f);
+        _emit(b, 0x80 | cc);
+    }
+    _add_fixup(&b->jumps, &b->jump_count, &b->jump_capacity, b->count, offset);
+    _emit32(b, 0);
+}
+
+static void _exit_if(jit_builder_t* b, int cc, int offset) {
+    _emit(b, 0x0f);
+    _emit(b, 0x80 | cc);
+    _add_fixup(&b->exits, &b->exit_count, &b->exit_capacity, b->count, offset);
+    _emit32(b, 0);
+}
+
+// forward jcc within a template, returns the position to patch
+static int _local_jump(jit_builder_t* b, int cc) {
+    _emit(b, 0x0f);
+    _emit(b, 0x80 | cc);
+    _emit32(b, 0);
+    return b->count - 4;
+}
+
+static void _patch_local(jit_builder_t* b, int at) {
+    _patch32(b, at, b->count - (at + 4));
+}
+
+static void _call(jit_builder_t* b, void* function) {
+    _move_imm(b, RAX, (uint64_t)(uintptr_t)function);
+    _emit(b, 0xff); // call rax
+    _emit(b, 0xd0);
+}
+
+static void _exit_at(jit_builder_t* b, int offset) {
+    _emit(b, 0xb8); // mov eax, offset
+    _emit32(b, (uint32_t)offset);
+    _jump_to(b, -1, -1);
+}
+
+// setcc al, movzx eax, al
+static void _set_flag(jit_builder_t* b, int cc) {
+    _emit(b, 0x0f); _emit(b, 0x90 | cc); _emit(b, 0xc0);
+    _emit(b, 0x0f); _emit(b, 0xb6); _emit(b, 0xc0);
+}
+
+// stores rax as a bool value
+static void _store_bool(jit_builder_t* b, int base, int32_t disp) {
+    _store_type(b, base, disp, VAL_BOOL);
+    _store(b, base, disp + VALUE_AS, RAX);
+}
+
+// Helpers called from native code
+
+static bool _set_global(obj_string_t* name, value_t* value) {
+    value_t existing;
+    if (!l_table_get(&vm.globals, name, &existing))
+        return false;
+
+    l_table_set(&vm.globals, name, *value);
+    return true;
+}
+
+// Templates
+
+static bool _is_number_operator(uint8_t op) {
+    return op == OP_ADD || op == OP_SUBTRACT || op == OP_MULTIPLY || op == OP_DIVIDE;
+}
+
+// Computes a op b for two numbers into xmm0 or rax (comparisons) and
+// stores the result at [dst + disp].
+static void _emit_number_binary(jit_builder_t* b, uint8_t op,
+                                int aBase, int32_t aDisp,
+                                int bBase, int32_t bDisp,
+                                int dst, int32_t dstDisp) {
+    switch (op) {
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            uint8_t sse = op == OP_ADD ? 0x58 : op == OP_SUBTRACT ? 0x5c
+                        : op == OP_MULTIPLY ? 0x59 : 0x5e;
+            MOVSD_LOAD(b, aBase, aDisp + VALUE_AS);
+            _sse(b, 0xf2, sse, 0, bBase, bDisp + VALUE_AS);
+            _store_type(b, dst, dstDisp, VAL_NUMBER);
+            MOVSD_STORE(b, dst, dstDisp + VALUE_AS);
+            break;
+        }
+        case OP_GREATER:
+            MOVSD_LOAD(b, aBase, aDisp + VALUE_AS);
+            UCOMISD(b, bBase, bDisp + VALUE_AS);
+            _set_flag(b, CC_A);
+            _store_bool(b, dst, dstDisp);
+            break;
+        case OP_LESS:
+            // a < b as b > a, so that NaN compares false
+            MOVSD_LOAD(b, bBase, bDisp + VALUE_AS);
+            UCOMISD(b, aBase, aDisp + VALUE_AS);
+            _set_flag(b, CC_A);
+            _store_bool(b, dst, dstDisp);
+            break;
+        case OP_EQUAL:
+            MOVSD_LOAD(b, aBase, aDisp + VALUE_AS);
+            UCOMISD(b, bBase, bDisp + VALUE_AS);
+            _emit(b, 0x0f); _emit(b, 0x90 | CC_E);  _emit(b, 0xc0); // sete al
+            _emit(b, 0x0f); _emit(b, 0x90 | CC_NP); _emit(b, 0xc1); // setnp cl
+            _emit(b, 0x20); _emit(b, 0xc8);                          // and al, cl
+            _emit(b, 0x0f); _emit(b, 0xb6); _emit(b, 0xc0);          // movzx eax, al
+            _store_bool(b, dst, dstDisp);
+            break;
+    }
+}
+
+static bool _emit_register_binary(jit_builder_t* b, chunk_t* chunk, int offset) {
+    uint8_t instruction = chunk->code[offset];
+    const uint8_t* operands = &chunk->code[offset + 1];
+    bool store = instruction == OP_STORE_BINARY_LL || instruction == OP_STORE_BINARY_LK;
+    bool constant = instruction == OP_BINARY_LK || instruction == OP_STORE_BINARY_LK;
+
+    uint8_t op = operands[0];
+    int dst = store ? operands[1] : -1;
+    int a = operands[store ? 2 : 1];
+    int k = operands[store ? 3 : 2];
+
+    // constants are known now, only numeric ones get a template
+    if (constant && !IS_NUMBER(chunk->constants.values[k]))
+        return false;
+
+    _compare_type(b, R12, a * VALUE_SIZE, VAL_NUMBER);
+    _exit_if(b, CC_NE, offset);
+    if (!constant) {
+        _compare_type(b, R12, k * VALUE_SIZE, VAL_NUMBER);
+        _exit_if(b, CC_NE, offset);
+    }
+
+    int bBase = constant ? R15 : R12;
+    if (store) {
+        _emit_number_binary(b, op, R12, a * VALUE_SIZE, bBase, k * VALUE_SIZE,
+                            R12, dst * VALUE_SIZE);
+    } else {
+        _emit_number_binary(b, op, R12, a * VALUE_SIZE, bBase, k * VALUE_SIZE, R14, 0);
+        _add_imm(b, R14, VALUE_SIZE);
+    }
+    return true;
+}
+
+// flips the sign of the number on top of the stack
+static void _emit_negate(jit_builder_t* b) {
+    _load(b, RAX, R14, -VALUE_SIZE + VALUE_AS);
+    _emit(b, 0x48); _emit(b, 0x0f); _emit(b, 0xba); // btc rax, 63
+    _emit(b, 0xf8); _emit(b, 0x3f);
+    _store(b, R14, -VALUE_SIZE + VALUE_AS, RAX);
+}
+
+// eax = 1 if the value on top of the stack is nil or false
+static void _emit_falsey(jit_builder_t* b) {
+    _rex(b, false, 0, R14);                           // mov eax, [r14 - 16]
+    _emit(b, 0x8b);
+    _memory(b, RAX, R14, -VALUE_SIZE + VALUE_TYPE);
+    _emit(b, 0x83); _emit(b, 0xf8); _emit(b, VAL_NIL);  // cmp eax, VAL_NIL
+    _emit(b, 0x0f); _emit(b, 0x94); _emit(b, 0xc1);    // sete cl
+    _emit(b, 0x83); _emit(b, 0xf8); _emit(b, VAL_BOOL); // cmp eax, VAL_BOOL
+    _emit(b, 0x0f); _emit(b, 0x94); _emit(b, 0xc2);    // sete dl
+    _rex(b, false, 0, R14);                           // cmp byte [r14 - 8], 0
+    _emit(b, 0x80);
+    _memory(b, 7, R14, -VALUE_SIZE + VALUE_AS);
+    _emit(b, 0);
+    _emit(b, 0x0f); _emit(b, 0x94); _emit(b, 0xc0);    // sete al
+    _emit(b, 0x20); _emit(b, 0xd0);                    // and al, dl
+    _emit(b, 0x08); _emit(b, 0xc8);                    // or al, cl
+    _emit(b, 0x0f); _emit(b, 0xb6); _emit(b, 0xc0);    // movzx eax, al
+}
+
+// loads the upvalue's location into rax
+static void _emit_upvalue_location(jit_builder_t* b, int slot) {
+    _load(b, RAX, R13, offsetof(callframe_t, closure));
+    _load(b, RAX, RAX, offsetof(obj_closure_t, upvalues));
+    _load(b, RAX, RAX, slot * (int)sizeof(obj_upvalue_t*));
+    _load(b, RAX, RAX, offsetof(obj_upvalue_t, location));
+}
+
+// Emits the template for the instruction at offset, returns false if
+// there isn't one.
+static bool _emit_instruction(jit_builder_t* b, chunk_t* chunk, int offset) {
+    uint8_t instruction = chunk->code[offset];
+    const uint8_t* operands = &chunk->code[offset + 1];
+
+    switch (instruction) {
+        case OP_CONSTANT:
+            MOVDQU_LOAD(b, R15, operands[0] * VALUE_SIZE);
+            MOVDQU_STORE(b, R14, 0);
+            _add_imm(b, R14, VALUE_SIZE);
+            return true;
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+            _store_type(b, R14, 0, instruction == OP_NIL ? VAL_NIL : VAL_BOOL);
+            _store_imm(b, R14, VALUE_AS, instruction == OP_TRUE);
+            _add_imm(b, R14, VALUE_SIZE);
+            return true;
+        case OP_POP:
+            _add_imm(b, R14, -VALUE_SIZE);
+            return true;
+        case OP_GET_LOCAL:
+            MOVDQU_LOAD(b, R12, operands[0] * VALUE_SIZE);
+            MOVDQU_STORE(b, R14, 0);
+            _add_imm(b, R14, VALUE_SIZE);
+            return true;
+        case OP_SET_LOCAL:
+            MOVDQU_LOAD(b, R14, -VALUE_SIZE);
+            MOVDQU_STORE(b, R12, operands[0] * VALUE_SIZE);
+            return true;
+        case OP_GET_GLOBAL: {
+            value_t name = chunk->constants.values[operands[0]];
+            _move_imm(b, RDI, (uint64_t)(uintptr_t)&vm.globals);
+            _move_imm(b, RSI, (uint64_t)(uintptr_t)AS_STRING(name));
+            _move(b, RDX, R14);
+            _call(b, (void*)l_table_get);
+            _emit(b, 0x84); _emit(b, 0xc0); // test al, al
+            _exit_if(b, CC_E, offset);
+            _add_imm(b, R14, VALUE_SIZE);
+            return true;
+        }
+        case OP_SET_GLOBAL: {
+            value_t name = chunk->constants.values[operands[0]];
+            // setting a global can grow the table and collect, the values
+            // pushed by native code must be on the stack the GC walks
+            _store(b, RBX, 0, R14);
+            _move_imm(b, RDI, (uint64_t)(uintptr_t)AS_STRING(name));
+            _move(b, RSI, R14);
+            _add_imm(b, RSI, -VALUE_SIZE);
+            _call(b, (void*)_set_global);
+            _emit(b, 0x84); _emit(b, 0xc0); // test al, al
+            _exit_if(b, CC_E, offset);
+            return true;
+        }
+        case OP_GET_UPVALUE:
+            _emit_upvalue_location(b, operands[0]);
+            MOVDQU_LOAD(b, RAX, 0);
+            MOVDQU_STORE(b, R14, 0);
+            _add_imm(b, R14, VALUE_SIZE);
+            return true;
+        case OP_SET_UPVALUE:
+            _emit_upvalue_location(b, operands[0]);
+            MOVDQU_LOAD(b, R14, -VALUE_SIZE);
+            MOVDQU_STORE(b, RAX, 0);
+            return true;
+        case OP_EQUAL:
+            // value_t is passed in two registers per argument
+            _load(b, RDI, R14, -2 * VALUE_SIZE);
+            _load(b, RSI, R14, -2 * VALUE_SIZE + 8);
+            _load(b, RDX, R14, -VALUE_SIZE);
+            _load(b, RCX, R14, -VALUE_SIZE + 8);
+            _call(b, (void*)l_values_equal);
+            _emit(b, 0x0f); _emit(b, 0xb6); _emit(b, 0xc0); // movzx eax, al
+            _store_bool(b, R14, -2 * VALUE_SIZE);
+            _add_imm(b, R14, -VALUE_SIZE);
+            return true;
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            _compare_type(b, R14, -2 * VALUE_SIZE, VAL_NUMBER);
+            _exit_if(b, CC_NE, offset);
+            _compare_type(b, R14, -VALUE_SIZE, VAL_NUMBER);
+            _exit_if(b, CC_NE, offset);
+            _emit_number_binary(b, instruction,
+                                R14, -2 * VALUE_SIZE,
+                                R14, -VALUE_SIZE,
+                                R14, -2 * VALUE_SIZE);
+            _add_imm(b, R14, -VALUE_SIZE);
+            return true;
+        case OP_NEGATE:
+            _compare_type(b, R14, -VALUE_SIZE, VAL_NUMBER);
+            _exit_if(b, CC_NE, offset);
+            _emit_negate(b);
+            return true;
+        case OP_NOT:
+            _emit_falsey(b);
+            _store_bool(b, R14, -VALUE_SIZE);
+            return true;
+        case OP_JUMP:
+        case OP_LOOP: {
+            int jump = (operands[0] << 8) | operands[1];
+            int target = instruction == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+            _jump_to(b, -1, target);
+            return true;
+        }
+        case OP_JUMP_IF_FALSE: {
+            int jump = (operands[0] << 8) | operands[1];
+            int target = offset + 3 + jump;
+            _rex(b, false, 0, R14);                           // mov eax, [r14 - 16]
+            _emit(b, 0x8b);
+            _memory(b, RAX, R14, -VALUE_SIZE + VALUE_TYPE);
+            _emit(b, 0x83); _emit(b, 0xf8); _emit(b, VAL_NIL);  // cmp eax, VAL_NIL
+            _jump_to(b, CC_E, target);
+            _emit(b, 0x85); _emit(b, 0xc0);                    // test eax, eax (VAL_BOOL)
+            int truthy = _local_jump(b, CC_NE);
+            _rex(b, false, 0, R14);                           // cmp byte [r14 - 8], 0
+            _emit(b, 0x80);
+            _memory(b, 7, R14, -VALUE_SIZE + VALUE_AS);
+            _emit(b, 0);
+            _jump_to(b, CC_E, target);
+            _patch_local(b, truthy);
+            return true;
+        }
+        case OP_BINARY_LL:
+        case OP_BINARY_LK:
+        case OP_STORE_BINARY_LL:
+        case OP_STORE_BINARY_LK:
+            return _emit_register_binary(b, chunk, offset);
+        default:
+            return false;
+    }
+}
+
+static void _free_builder(jit_builder_t* b) {
+    FREE_ARRAY(uint8_t, b->code, b->capacity);
+    FREE_ARRAY(jit_fixup_t, b->jumps, b->jump_capacity);
+    FREE_ARRAY(jit_fixup_t, b->exits, b->exit_capacity);
+}
+
+// called as entry(frame, target), loads the pinned registers and jumps to
+// the target
+static void _emit_prologue(jit_builder_t* b, chunk_t* chunk) {
+    _push(b, RBX);
+    _push(b, R12);
+    _push(b, R13);
+    _push(b, R14);
+    _push(b, R15);
+    _move(b, R13, RDI);
+    _load(b, R12, R13, offsetof(callframe_t, slots));
+    _move_imm(b, RBX, (uint64_t)(uintptr_t)&vm.stack_top);
+    _load(b, R14, RBX, 0);
+    _move_imm(b, R15, (uint64_t)(uintptr_t)chunk->constants.values);
+    _emit(b, 0xff); // jmp rsi
+    _emit(b, 0xe6);
+}
+
+// Emits the shared exit and the stubs for failed guards, returns the
+// position of the shared exit.
+static int _emit_epilogue(jit_builder_t* b) {
+    // eax holds the bytecode offset to resume at
+    int exit = b->count;
+    _store(b, RBX, 0, R14);
+    _pop(b, R15);
+    _pop(b, R14);
+    _pop(b, R13);
+    _pop(b, R12);
+    _pop(b, RBX);
+    _emit(b, 0xc3); // ret
+
+    for (int i = 0; i < b->exit_count; i++) {
+        jit_fixup_t* fixup = &b->exits[i];
+        _patch32(b, fixup->at, b->count - (fixup->at + 4));
+        _emit(b, 0xb8); // mov eax, offset
+        _emit32(b, (uint32_t)fixup->offset);
+        _emit(b, 0xe9);
+        _emit32(b, (uint32_t)(exit - (b->count + 4)));
+    }
+    return exit;
+}
+
+// copies the code into executable memory, NULL on failure
+static uint8_t* _install(jit_builder_t* b) {
+    uint8_t* code = mmap(NULL, b->count, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return NULL;
+
+    memcpy(code, b->code, b->count);
+    if (mprotect(code, b->count, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, b->count);
+        return NULL;
+    }
+    return code;
+}
+
+bool l_jit_compile(obj_function_t* function) {
+    _Static_assert(sizeof(value_t) == 16, "templates assume 16 byte values");
+
+    chunk_t* chunk = &function->chunk;
+    jit_builder_t b = {0};
+
+    int* native = ALLOCATE(int, chunk->count);
+    int* entries = ALLOCATE(int, chunk->count);
+    for (int i = 0; i < chunk->count; i++) {
+        native[i] = -1;
+        entries[i] = -1;
+    }
+
+    _emit_prologue(&b, chunk);
+
+    bool supported = false;
+    for (int offset = 0; offset < chunk->count; offset += l_instruction_length(chunk, offset)) {
+        native[offset] = b.count;
+        if (_emit_instruction(&b, chunk, offset)) {
+            entries[offset] = native[offset];
+            supported = true;
+        } else {
+            _exit_at(&b, offset);
+        }
+    }
+
+    int exit = _emit_epilogue(&b);
+    for (int i = 0; i < b.jump_count; i++) {
+        jit_fixup_t* fixup = &b.jumps[i];
+        int target = fixup->offset < 0 ? exit : native[fixup->offset];
+        _patch32(&b, fixup->at, target - (fixup->at + 4));
+    }
+
+    FREE_ARRAY(int, native, chunk->count);
+
+    uint8_t* code = supported ? _install(&b) : NULL;
+    if (code == NULL) {
+        FREE_ARRAY(int, entries, chunk->count);
+        _free_builder(&b);
+        return false;
+    }
+
+    jit_code_t* jit = ALLOCATE(jit_code_t, 1);
+    jit->code = code;
+    jit->size = b.count;
+    jit->entries = entries;
+    jit->entry_count = chunk->count;
+    function->jit = jit;
+
+    _free_builder(&b);
+    return true;
+}
+
+void l_jit_free_code(obj_function_t* function) {
+    jit_trace_t* trace = function->traces;
+    while (trace != NULL) {
+        jit_trace_t* next = trace->next;
+        munmap(trace->code, trace->size);
+        FREE(jit_trace_t, trace);
+        trace = next;
+    }
+    function->traces = NULL;
+
+    if (function->loop_hotness != NULL) {
+        FREE_ARRAY(uint16_t, function->loop_hotness, function->chunk.count);
+        function->loop_hotness = NULL;
+    }
+
+    jit_code_t* jit = function->jit;
+    if (jit == NULL)
+        return;
+
+    munmap(jit->code, jit->size);
+    FREE_ARRAY(int, jit->entries, jit->entry_count);
+    FREE(jit_code_t, jit);
+    function->jit = NULL;
+}
+
+void l_jit_execute(callframe_t* frame) {
+    obj_function_t* function = frame->closure->function;
+    jit_code_t* jit = function->jit;
+
+    int offset = (int)(frame->ip - function->chunk.code);
+    if (jit->entries[offset] < 0)
+        return;
+
+    jit_entry_t entry = (jit_entry_t)jit->code;
+    offset = entry(frame, jit->code + jit->entries[offset]);
+    frame->ip = function->chunk.code + offset;
+}
+
+// Tracing
+//
+// Back edges count how often each loop header is reached. Once a loop is
+// hot the interpreter records the instructions of one iteration along with
+// the operand types it sees, and the recording is compiled into a straight
+// line of native code specialised for those types. Locals that held numbers
+// are checked once at the top of each iteration, after which arithmetic on
+// them needs no guards. Branches that went the other way while recording
+// and values of a different type leave the trace through guard exits.
+
+#define TRACE_HOT_LOOPS   32
+#define TRACE_MAX_LENGTH  512
+#define TRACE_COMPILED    (UINT16_MAX - 1)
+#define TRACE_BLACKLISTED UINT16_MAX
+
+#define TYPE_UNKNOWN 0xff
+
+typedef struct {
+    int     offset;
+    uint8_t types[2]; // observed operand types, TYPE_UNKNOWN if not relevant
+} trace_step_t;
+
+typedef struct {
+    obj_function_t* function;
+    int             frame_index;
+    int             header;
+    int             base;        // stack depth at the header, in slots
+    trace_step_t*   steps;
+    int             count;
+    int             capacity;
+} trace_recorder_t;
+
+static trace_recorder_t _recorder;
+
+static bool _is_traceable(uint8_t op) {
+    switch (op) {
+        case OP_CONSTANT:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_POP:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_BINARY_LL:
+        case OP_BINARY_LK:
+        case OP_STORE_BINARY_LL:
+        case OP_STORE_BINARY_LK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void _stop_recording() {
+    FREE_ARRAY(trace_step_t, _recorder.steps, _recorder.capacity);
+    _recorder.function = NULL;
+    _recorder.steps = NULL;
+    _recorder.count = 0;
+    _recorder.capacity = 0;
+    vm.trace_recording = false;
+}
+
+// gives up on the loop being recorded, it won't be recorded again
+static void _abort_recording() {
+    _recorder.function->loop_hotness[_recorder.header] = TRACE_BLACKLISTED;
+    _stop_recording();
+}
+
+void l_trace_abort() {
+    if (vm.trace_recording)
+        _abort_recording();
+}
+
+static uint8_t _value_type(value_t value) {
+    return (uint8_t)value.type;
+}
+
+void l_trace_record(callframe_t* frame) {
+    obj_function_t* function = frame->closure->function;
+    if (function != _recorder.function || vm.frame_count - 1 != _recorder.frame_index) {
+        _abort_recording();
+        return;
+    }
+
+    chunk_t* chunk = &function->chunk;
+    int offset = (int)(frame->ip - chunk->code);
+    uint8_t op = chunk->code[offset];
+    if (!_is_traceable(op) || _recorder.count == TRACE_MAX_LENGTH) {
+        _abort_recording();
+        return;
+    }
+
+    if (_recorder.capacity < _recorder.count + 1) {
+        int oldCapacity = _recorder.capacity;
+        _recorder.capacity = GROW_CAPACITY(oldCapacity);
+        _recorder.steps = GROW_ARRAY(trace_step_t, _recorder.steps, oldCapacity, _recorder.capacity);
+    }
+
+    trace_step_t* step = &_recorder.steps[_recorder.count++];
+    step->offset = offset;
+    step->types[0] = TYPE_UNKNOWN;
+    step->types[1] = TYPE_UNKNOWN;
+
+    const uint8_t* operands = &chunk->code[offset + 1];
+    switch (op) {
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            step->types[0] = _value_type(vm.stack_top[-2]);
+            step->types[1] = _value_type(vm.stack_top[-1]);
+            break;
+        case OP_NEGATE:
+            step->types[0] = _value_type(vm.stack_top[-1]);
+            break;
+        case OP_GET_LOCAL:
+            step->types[0] = _value_type(frame->slots[operands[0]]);
+            break;
+        case OP_BINARY_LL:
+        case OP_BINARY_LK:
+        case OP_STORE_BINARY_LL:
+        case OP_STORE_BINARY_LK: {
+            bool store = op == OP_STORE_BINARY_LL || op == OP_STORE_BINARY_LK;
+            bool constant = op == OP_BINARY_LK || op == OP_STORE_BINARY_LK;
+            uint8_t a = operands[store ? 2 : 1];
+            uint8_t k = operands[store ? 3 : 2];
+            step->types[0] = _value_type(frame->slots[a]);
+            step->types[1] = _value_type(constant ? chunk->constants.values[k] : frame->slots[k]);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+typedef struct {
+    uint8_t locals[UINT8_COUNT];
+    uint8_t stack[TRACE_MAX_LENGTH];
+    int     depth;
+} trace_types_t;
+
+// Slots from the header's stack depth up hold what the loop body pushes,
+// including the vars declared in it. They are pushed again each iteration
+// so their types are tracked on the type stack rather than as locals.
+static uint8_t _local_type(trace_types_t* types, int slot) {
+    if (slot < _recorder.base)
+        return types->locals[slot];
+
+    int index = slot - _recorder.base;
+    if (index >= types->depth || index >= TRACE_MAX_LENGTH)
+        return TYPE_UNKNOWN;
+    return types->stack[index];
+}
+
+static void _set_local_type(trace_types_t* types, int slot, uint8_t type) {
+    if (slot < _recorder.base) {
+        types->locals[slot] = type;
+        return;
+    }
+
+    int index = slot - _recorder.base;
+    if (index < types->depth && index < TRACE_MAX_LENGTH)
+        types->stack[index] = type;
+}
+
+static void _push_type(trace_types_t* types, uint8_t type) {
+    if (types->depth >= 0 && types->depth < TRACE_MAX_LENGTH)
+        types->stack[types->depth] = type;
+    types->depth++;
+}
+
+static uint8_t _pop_type(trace_types_t* types) {
+    types->depth--;
+    if (types->depth < 0 || types->depth >= TRACE_MAX_LENGTH)
+        return TYPE_UNKNOWN;
+    return types->stack[types->depth];
+}
+
+static uint8_t _peek_type(trace_types_t* types) {
+    uint8_t type = _pop_type(types);
+    types->depth++;
+    return type;
+}
+
+static uint8_t _binary_result_type(uint8_t op) {
+    return op == OP_EQUAL || op == OP_GREATER || op == OP_LESS ? VAL_BOOL : VAL_NUMBER;
+}
+
+// checks the locals the trace reads before writing them and saw holding
+// numbers, they are then known to be numbers for the rest of the iteration.
+// Slots the body pushes hold whatever the last iteration left at the header
+// and aren't guarded.
+static void _emit_entry_guards(jit_builder_t* b, chunk_t* chunk, trace_types_t* types) {
+    bool written[UINT8_COUNT] = {false};
+
+    for (int i = 0; i < _recorder.count; i++) {
+        trace_step_t* step = &_recorder.steps[i];
+        uint8_t op = chunk->code[step->offset];
+        const uint8_t* operands = &chunk->code[step->offset + 1];
+
+        int reads[2] = {-1, -1};
+        int write = -1;
+        switch (op) {
+            case OP_GET_LOCAL:
+                reads[0] = operands[0];
+                break;
+            case OP_SET_LOCAL:
+                write = operands[0];
+                break;
+            case OP_BINARY_LL:
+                reads[0] = operands[1];
+                reads[1] = operands[2];
+                break;
+            case OP_BINARY_LK:
+                reads[0] = operands[1];
+                break;
+            case OP_STORE_BINARY_LL:
+                reads[0] = operands[2];
+                reads[1] = operands[3];
+                write = operands[1];
+                break;
+            case OP_STORE_BINARY_LK:
+                reads[0] = operands[2];
+                write = operands[1];
+                break;
+            default:
+                break;
+        }
+
+        for (int r = 0; r < 2; r++) {
+            int slot = reads[r];
+            if (slot < 0 || slot >= _recorder.base || written[slot] ||
+                types->locals[slot] != TYPE_UNKNOWN ||
+                step->types[r] != VAL_NUMBER) {
+                continue;
+            }
+
+            _compare_type(b, R12, slot * VALUE_SIZE, VAL_NUMBER);
+            _exit_if(b, CC_NE, _recorder.header);
+            types->locals[slot] = VAL_NUMBER;
+        }
+
+        if (write >= 0)
+            written[write] = true;
+    }
+}
+
+// Emits a binary operation whose operands were numbers while recording,
+// guarding only the operands whose type isn't already known.
+static void _emit_trace_binary(jit_builder_t* b, int offset, uint8_t op,
+                               uint8_t aType, int aBase, int32_t aDisp,
+                               uint8_t bType, int bBase, int32_t bDisp,
+                               int dst, int32_t dstDisp) {
+    if (aType != VAL_NUMBER) {
+        _compare_type(b, aBase, aDisp, VAL_NUMBER);
+        _exit_if(b, CC_NE, offset);
+    }
+    if (bType != VAL_NUMBER) {
+        _compare_type(b, bBase, bDisp, VAL_NUMBER);
+        _exit_if(b, CC_NE, offset);
+    }
+    _emit_number_binary(b, op, aBase, aDisp, bBase, bDisp, dst, dstDisp);
+}
+
+static bool _emit_trace_step(jit_builder_t* b, chunk_t* chunk, trace_types_t* types, int index, int loop) {
+    trace_step_t* step = &_recorder.steps[index];
+    int offset = step->offset;
+    uint8_t op = chunk->code[offset];
+    const uint8_t* operands = &chunk->code[offset + 1];
+
+    switch (op) {
+        case OP_CONSTANT:
+            _push_type(types, _value_type(chunk->constants.values[operands[0]]));
+            return _emit_instruction(b, chunk, offset);
+        case OP_NIL:
+            _push_type(types, VAL_NIL);
+            return _emit_instruction(b, chunk, offset);
+        case OP_TRUE:
+        case OP_FALSE:
+            _push_type(types, VAL_BOOL);
+            return _emit_instruction(b, chunk, offset);
+        case OP_POP:
+            _pop_type(types);
+            return _emit_instruction(b, chunk, offset);
+        case OP_GET_LOCAL:
+            _push_type(types, _local_type(types, operands[0]));
+            return _emit_instruction(b, chunk, offset);
+        case OP_SET_LOCAL:
+            _set_local_type(types, operands[0], _peek_type(types));
+            return _emit_instruction(b, chunk, offset);
+        case OP_GET_GLOBAL:
+        case OP_GET_UPVALUE:
+            _push_type(types, TYPE_UNKNOWN);
+            return _emit_instruction(b, chunk, offset);
+        case OP_SET_GLOBAL:
+        case OP_SET_UPVALUE:
+            return _emit_instruction(b, chunk, offset);
+        case OP_NOT:
+            _pop_type(types);
+            _push_type(types, VAL_BOOL);
+            return _emit_instruction(b, chunk, offset);
+        case OP_EQUAL: {
+            uint8_t bType = _pop_type(types);
+            uint8_t aType = _pop_type(types);
+            _push_type(types, VAL_BOOL);
+            if (aType != VAL_NUMBER || bType != VAL_NUMBER)
+                return _emit_instruction(b, chunk, offset);
+
+            _emit_number_binary(b, op, R14, -2 * VALUE_SIZE, R14, -VALUE_SIZE, R14, -2 * VALUE_SIZE);
+            _add_imm(b, R14, -VALUE_SIZE);
+            return true;
+        }
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE: {
+            uint8_t bType = _pop_type(types);
+            uint8_t aType = _pop_type(types);
+            _push_type(types, _binary_result_type(op));
+
+            // anything else, like string concatenation, stays interpreted
+            if (step->types[0] != VAL_NUMBER || step->types[1] != VAL_NUMBER)
+                return false;
+
+            _emit_trace_binary(b, offset, op,
+                               aType, R14, -2 * VALUE_SIZE,
+                               bType, R14, -VALUE_SIZE,
+                               R14, -2 * VALUE_SIZE);
+            _add_imm(b, R14, -VALUE_SIZE);
+            return true;
+        }
+        case OP_NEGATE: {
+            uint8_t type = _pop_type(types);
+            _push_type(types, VAL_NUMBER);
+            if (step->types[0] != VAL_NUMBER)
+                return false;
+
+            if (type != VAL_NUMBER) {
+                _compare_type(b, R14, -VALUE_SIZE, VAL_NUMBER);
+                _exit_if(b, CC_NE, offset);
+            }
+            _emit_negate(b);
+            return true;
+        }
+        case OP_JUMP:
+            // the trace continues at the target
+            return true;
+        case OP_LOOP:
+            // back edges of enclosing or sibling loops are followed like
+            // jumps, the last one closes the trace
+            if (index == _recorder.count - 1) {
+                _emit(b, 0xe9);
+                _emit32(b, (uint32_t)(loop - (b->count + 4)));
+            }
+            return true;
+        case OP_JUMP_IF_FALSE: {
+            int jump = (operands[0] << 8) | operands[1];
+            int target = offset + 3 + jump;
+            int next = index + 1 < _recorder.count ? _recorder.steps[index + 1].offset : -1;
+            bool taken = next == target;
+            int other = taken ? offset + 3 : target;
+
+            if (_peek_type(types) == VAL_BOOL) {
+                _rex(b, false, 0, R14);                        // cmp byte [r14 - 8], 0
+                _emit(b, 0x80);
+                _memory(b, 7, R14, -VALUE_SIZE + VALUE_AS);
+                _emit(b, 0);
+                _exit_if(b, taken ? CC_NE : CC_E, other);
+            } else {
+                _emit_falsey(b);
+                _emit(b, 0x85); _emit(b, 0xc0);                 // test eax, eax
+                _exit_if(b, taken ? CC_E : CC_NE, other);
+            }
+            return true;
+        }
+        case OP_BINARY_LL:
+        case OP_BINARY_LK:
+        case OP_STORE_BINARY_LL:
+        case OP_STORE_BINARY_LK: {
+            bool store = op == OP_STORE_BINARY_LL || op == OP_STORE_BINARY_LK;
+            bool constant = op == OP_BINARY_LK || op == OP_STORE_BINARY_LK;
+            uint8_t binary = operands[0];
+            int dst = store ? operands[1] : -1;
+            int a = operands[store ? 2 : 1];
+            int k = operands[store ? 3 : 2];
+
+            if (step->types[0] != VAL_NUMBER || step->types[1] != VAL_NUMBER)
+                return false;
+
+            uint8_t aType = _local_type(types, a);
+            uint8_t bType = constant ? VAL_NUMBER : _local_type(types, k);
+            int bBase = constant ? R15 : R12;
+            uint8_t result = _binary_result_type(binary);
+
+            if (store) {
+                _emit_trace_binary(b, offset, binary,
+                                   aType, R12, a * VALUE_SIZE,
+                                   bType, bBase, k * VALUE_SIZE,
+                                   R12, dst * VALUE_SIZE);
+                _set_local_type(types, dst, result);
+            } else {
+                _emit_trace_binary(b, offset, binary,
+                                   aType, R12, a * VALUE_SIZE,
+                                   bType, bBase, k * VALUE_SIZE,
+                                   R14, 0);
+                _add_imm(b, R14, VALUE_SIZE);
+                _push_type(types, result);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool _compile_trace() {
+    obj_function_t* function = _recorder.function;
+    chunk_t* chunk = &function->chunk;
+
+    // a complete recording ends with the loop's own back edge
+    if (_recorder.count == 0 ||
+        chunk->code[_recorder.steps[_recorder.count - 1].offset] != OP_LOOP) {
+        return false;
+    }
+
+    jit_builder_t b = {0};
+    _emit_prologue(&b, chunk);
+
+    trace_types_t types;
+    memset(types.locals, TYPE_UNKNOWN, sizeof(types.locals));
+    types.depth = 0;
+
+    int loop = b.count;
+    _emit_entry_guards(&b, chunk, &types);
+
+    bool compiled = true;
+    for (int i = 0; i < _recorder.count && compiled; i++) {
+        compiled = _emit_trace_step(&b, chunk, &types, i, loop);
+    }
+
+    int exit = _emit_epilogue(&b);
+    for (int i = 0; i < b.jump_count; i++) {
+        _patch32(&b, b.jumps[i].at, exit - (b.jumps[i].at + 4));
+    }
+
+    uint8_t* code = compiled ? _install(&b) : NULL;
+    if (code != NULL) {
+        jit_trace_t* trace = ALLOCATE(jit_trace_t, 1);
+        trace->header = _recorder.header;
+        trace->code = code;
+        trace->size = b.count;
+        trace->entry = loop;
+        trace->next = function->traces;
+        function->traces = trace;
+    }
+
+    _free_builder(&b);
+    return code != NULL;
+}
+
+void l_trace_loop(callframe_t* frame) {
+    obj_function_t* function = frame->closure->function;
+    int header = (int)(frame->ip - function->chunk.code);
+
+    // loops in baseline compiled functions already run natively
+    if (function->jit != NULL)
+        return;
+
+    if (vm.trace_recording) {
+        if (function != _recorder.function ||
+            header != _recorder.header ||
+            vm.frame_count - 1 != _recorder.frame_index) {
+            return;
+        }
+
+        TIMELINE_BEGIN(TIMELINE_COMPILE, "jit trace");
+        bool compiled = _compile_trace();
+        TIMELINE_END(TIMELINE_COMPILE);
+
+        if (compiled) {
+            function->loop_hotness[header] = TRACE_COMPILED;
+            _stop_recording();
+        } else {
+            _abort_recording();
+        }
+        return;
+    }
+
+    if (function->loop_hotness == NULL) {
+        function->loop_hotness = ALLOCATE(uint16_t, function->chunk.count);
+        memset(function->loop_hotness, 0, sizeof(uint16_t) * function->chunk.count);
+    }
+
+    uint16_t* hotness = &function->loop_hotness[header];
+    if (*hotness == TRACE_COMPILED) {
+        for (jit_trace_t* trace = function->traces; trace != NULL; trace = trace->next) {
+            if (trace->header == header) {
+                jit_entry_t entry = (jit_entry_t)trace->code;
+                int offset = entry(frame, trace->code + trace->entry);
+                frame->ip = function->chunk.code + offset;
+                return;
+            }
+        }
+    }
+    else if (*hotness < TRACE_HOT_LOOPS) {
+        if (++*hotness == TRACE_HOT_LOOPS) {
+            _recorder.function = function;
+            _recorder.frame_index = vm.frame_count - 1;
+            _recorder.header = header;
+            _recorder.base = (int)(vm.stack_top - frame->slots);
+            vm.trace_recording = true;
+        }
+    }
+}
+
+#endif
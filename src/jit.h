@@ -0,0 +1,53 @@
+#ifndef LOX_JIT_H
+#define LOX_JIT_H
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+#ifdef LOX_JIT
+
+// number of calls before a function is compiled to native code
+#define JIT_HOT_CALLS 64
+
+// Native code for a function. Every instruction the JIT supports has an
+// entry point, execution leaves native code at the first instruction it
+// can't handle and the interpreter carries on from there.
+struct jit_code_t {
+    uint8_t* code;
+    size_t   size;
+    int*     entries;     // native offset for each bytecode offset, -1 if none
+    int      entry_count;
+};
+
+void l_set_jit_enabled(bool enabled);
+bool l_jit_enabled();
+
+bool l_jit_compile(obj_function_t* function);
+void l_jit_free_code(obj_function_t* function);
+
+// Runs the frame's native code from frame->ip, on return frame->ip and
+// vm.stack_top point at the next instruction to interpret.
+void l_jit_execute(callframe_t* frame);
+
+// A compiled trace of one iteration of a hot loop, entered at the loop
+// header and left at the first guard that fails.
+struct jit_trace_t {
+    int          header;  // bytecode offset of the loop header
+    uint8_t*     code;
+    size_t       size;
+    int          entry;   // native offset of the trace in code
+    jit_trace_t* next;
+};
+
+// Called on every back edge with frame->ip at the loop header. Counts the
+// loop, starts and finishes recording, and runs the loop's trace once one
+// exists, leaving frame->ip where the trace exited.
+void l_trace_loop(callframe_t* frame);
+// Called before each instruction while vm.trace_recording is set.
+void l_trace_record(callframe_t* frame);
+void l_trace_abort();
+
+#endif
+
+#endif
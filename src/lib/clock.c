@@ -0,0 +1,14 @@
+#include <time.h>
+
+#include "lib/clock.h"
+
+uint64_t l_now_ns() {
+#ifdef LOX_WINDOWS
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+#endif
+    return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+}
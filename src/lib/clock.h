@@ -0,0 +1,10 @@
+#ifndef LIB_CLOCK_H
+#define LIB_CLOCK_H
+
+#include "common.h"
+
+// Nanoseconds from a monotonic clock, for timing intervals. The origin is
+// arbitrary so only differences between readings are meaningful.
+uint64_t l_now_ns();
+
+#endif
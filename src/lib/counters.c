@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/counters.h"
+
+static uint32_t _hash(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static counter_t* _find_entry(counter_t* entries, int capacity,
+                              const char* key, uint32_t hash) {
+    uint32_t index = hash & (capacity - 1);
+    for (;;) {
+        counter_t* entry = &entries[index];
+        if (entry->key == NULL ||
+            (entry->hash == hash && strcmp(entry->key, key) == 0)) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+static bool _grow(counter_table_t* table) {
+    int capacity = table->capacity < 64 ? 64 : table->capacity * 2;
+    counter_t* entries = calloc(capacity, sizeof(counter_t));
+    if (entries == NULL)
+        return false;
+
+    for (int i = 0; i < table->capacity; i++) {
+        counter_t* entry = &table->entries[i];
+        if (entry->key == NULL)
+            continue;
+        *_find_entry(entries, capacity, entry->key, entry->hash) = *entry;
+    }
+
+    free(table->entries);
+    table->entries = entries;
+    table->capacity = capacity;
+    return true;
+}
+
+void l_init_counter_table(counter_table_t* table, size_t dataSize) {
+    table->entries = NULL;
+    table->count = 0;
+    table->capacity = 0;
+    table->data_size = dataSize;
+}
+
+void l_free_counter_table(counter_table_t* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        free(table->entries[i].key);
+        free(table->entries[i].data);
+    }
+    free(table->entries);
+    l_init_counter_table(table, table->data_size);
+}
+
+counter_t* l_count_key(counter_table_t* table, const char* key, int length) {
+    // keep the load factor under 3/4
+    if ((table->count + 1) * 4 > table->capacity * 3 && !_grow(table))
+        return NULL;
+
+    uint32_t hash = _hash(key, length);
+    counter_t* entry = _find_entry(table->entries, table->capacity, key, hash);
+    if (entry->key == NULL) {
+        char* copy = malloc(length + 1);
+        void* data = table->data_size > 0 ? calloc(1, table->data_size) : NULL;
+        if (copy == NULL || (table->data_size > 0 && data == NULL)) {
+            free(copy);
+            free(data);
+            return NULL;
+        }
+        memcpy(copy, key, length);
+        copy[length] = '\0';
+        entry->key = copy;
+        entry->hash = hash;
+        entry->count = 0;
+        entry->data = data;
+        table->count++;
+    }
+    entry->count++;
+    return entry;
+}
+
+int l_counter_table_next(counter_table_t* table, int index) {
+    for (int i = index + 1; i < table->capacity; i++) {
+        if (table->entries[i].key != NULL)
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,35 @@
+#ifndef LIB_COUNTERS_H
+#define LIB_COUNTERS_H
+
+#include "common.h"
+
+// A string keyed table of counts for the profiling tools. It's plain
+// malloc'd memory so counting never allocates from, or triggers, the GC.
+// Each key can carry a block of data for the caller, zeroed when the key
+// is added.
+typedef struct {
+    char*    key;       // NULL for an empty slot
+    uint32_t hash;
+    int      count;
+    void*    data;      // data_size bytes, NULL when data_size is 0
+} counter_t;
+
+typedef struct {
+    counter_t* entries;
+    int        count;
+    int        capacity;
+    size_t     data_size;
+} counter_table_t;
+
+void l_init_counter_table(counter_table_t* table, size_t dataSize);
+void l_free_counter_table(counter_table_t* table);
+
+// Adds one to the count of key, adding the key first if it's new. Returns
+// the key's counter, or NULL if memory ran out and nothing was counted.
+counter_t* l_count_key(counter_table_t* table, const char* key, int length);
+
+// Returns the index of the next counter in the entries after index, start
+// with -1, or -1 once they've all been visited.
+int l_counter_table_next(counter_table_t* table, int index);
+
+#endif
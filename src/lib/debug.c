@@ -12,6 +12,68 @@ void l_dissassemble_chunk(chunk_t *chunk, const char *name) {
     }
 }
 
+#define NAME(op) [op] = #op
+
+static const char* _opcode_names[] = {
+    NAME(OP_CONSTANT),
+    NAME(OP_NIL),
+    NAME(OP_TRUE),
+    NAME(OP_FALSE),
+    NAME(OP_POP),
+    NAME(OP_GET_LOCAL),
+    NAME(OP_SET_LOCAL),
+    NAME(OP_GET_GLOBAL),
+    NAME(OP_DEFINE_GLOBAL),
+    NAME(OP_SET_GLOBAL),
+    NAME(OP_GET_UPVALUE),
+    NAME(OP_SET_UPVALUE),
+    NAME(OP_GET_PROPERTY),
+    NAME(OP_SET_PROPERTY),
+    NAME(OP_GET_SUPER),
+    NAME(OP_EQUAL),
+    NAME(OP_GREATER),
+    NAME(OP_LESS),
+    NAME(OP_ADD),
+    NAME(OP_SUBTRACT),
+    NAME(OP_MULTIPLY),
+    NAME(OP_DIVIDE),
+    NAME(OP_NEGATE),
+    NAME(OP_NOT),
+    NAME(OP_PRINT),
+    NAME(OP_JUMP),
+    NAME(OP_JUMP_IF_FALSE),
+    NAME(OP_LOOP),
+    NAME(OP_CALL),
+    NAME(OP_INVOKE),
+    NAME(OP_SUPER_INVOKE),
+    NAME(OP_CLOSURE),
+    NAME(OP_CLOSE_UPVALUE),
+    NAME(OP_RETURN),
+    NAME(OP_CLASS),
+    NAME(OP_INHERIT),
+    NAME(OP_METHOD),
+    NAME(OP_BUILD_LIST),
+    NAME(OP_BUILD_MAP),
+    NAME(OP_GET_INDEX),
+    NAME(OP_SET_INDEX),
+    NAME(OP_TAIL_CALL),
+    NAME(OP_TAIL_INVOKE),
+    NAME(OP_BINARY_LL),
+    NAME(OP_BINARY_LK),
+    NAME(OP_STORE_BINARY_LL),
+    NAME(OP_STORE_BINARY_LK),
+    NAME(OP_COVERAGE),
+};
+
+#undef NAME
+
+const char* l_opcode_name(uint8_t op) {
+    int count = sizeof(_opcode_names) / sizeof(_opcode_names[0]);
+    if (op >= count || _opcode_names[op] == NULL)
+        return "OP_UNKNOWN";
+    return _opcode_names[op];
+}
+
 static int _constant_instruction(const char* name, chunk_t* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
@@ -47,14 +109,49 @@ static int _jump_instruction(const char* name, int sign, chunk_t* chunk, int off
     return offset + 3;
 }
 
+static const char* _binary_operator(uint8_t op) {
+    switch (op) {
+        case OP_EQUAL:    return "==";
+        case OP_GREATER:  return ">";
+        case OP_LESS:     return "<";
+        case OP_ADD:      return "+";
+        case OP_SUBTRACT: return "-";
+        case OP_MULTIPLY: return "*";
+        case OP_DIVIDE:   return "/";
+        default:          return "?";
+    }
+}
+
+static int _register_instruction(const char* name, bool store, bool constant, chunk_t* chunk, int offset) {
+    const uint8_t* operands = &chunk->code[offset + 1];
+    int next = offset + 4;
+
+    printf("%-16s ", name);
+    if (store) {
+        printf("r%d = ", operands[1]);
+        operands++;
+        next++;
+    }
+
+    printf("r%d %s ", operands[1], _binary_operator(operands[0]));
+    if (constant) {
+        printf("'");
+        l_print_value(chunk->constants.values[operands[2]]);
+        printf("'\n");
+    } else {
+        printf("r%d\n", operands[2]);
+    }
+    return next;
+}
+
 int l_disassemble_instruction(chunk_t* chunk, int offset) {
     printf("%04d ", offset);
 
     if (offset > 0 &&
-        chunk->lines[offset] == chunk->lines[offset - 1]) {
+        l_get_line(chunk, offset) == l_get_line(chunk, offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", l_get_line(chunk, offset));
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -120,6 +217,10 @@ int l_disassemble_instruction(chunk_t* chunk, int offset) {
             return _byte_instruction("OP_CALL", chunk, offset);
         case OP_INVOKE:
             return _invoke_instruction("OP_INVOKE", chunk, offset);
+        case OP_TAIL_CALL:
+            return _byte_instruction("OP_TAIL_CALL", chunk, offset);
+        case OP_TAIL_INVOKE:
+            return _invoke_instruction("OP_TAIL_INVOKE", chunk, offset);
         case OP_SUPER_INVOKE:
             return _invoke_instruction("OP_SUPER_INVOKE", chunk, offset);
         case OP_CLOSURE: {
@@ -149,6 +250,24 @@ int l_disassemble_instruction(chunk_t* chunk, int offset) {
             return _simple_instruction("OP_INHERIT", offset);
         case OP_METHOD:
             return _constant_instruction("OP_METHOD", chunk, offset);
+        case OP_BUILD_LIST:
+            return _byte_instruction("OP_BUILD_LIST", chunk, offset);
+        case OP_BUILD_MAP:
+            return _byte_instruction("OP_BUILD_MAP", chunk, offset);
+        case OP_GET_INDEX:
+            return _simple_instruction("OP_GET_INDEX", offset);
+        case OP_SET_INDEX:
+            return _simple_instruction("OP_SET_INDEX", offset);
+        case OP_BINARY_LL:
+            return _register_instruction("OP_BINARY_LL", false, false, chunk, offset);
+        case OP_BINARY_LK:
+            return _register_instruction("OP_BINARY_LK", false, true, chunk, offset);
+        case OP_STORE_BINARY_LL:
+            return _register_instruction("OP_STORE_BINARY_LL", true, false, chunk, offset);
+        case OP_STORE_BINARY_LK:
+            return _register_instruction("OP_STORE_BINARY_LK", true, true, chunk, offset);
+        case OP_COVERAGE:
+            return _simple_instruction("OP_COVERAGE", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
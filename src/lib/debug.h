@@ -6,4 +6,7 @@
 void l_dissassemble_chunk(chunk_t *chunk, const char *name);
 int  l_disassemble_instruction(chunk_t *chunk, int offset);
 
+// the name of the opcode as written in the disassembly, e.g. "OP_ADD"
+const char* l_opcode_name(uint8_t op);
+
 #endif
\ No newline at end of file
@@ -1,10 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
+#ifdef LOX_WINDOWS
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "compiler.h"
+#include "serialize.h"
+#include "timeline.h"
 #include "lib/file.h"
 #include "vm.h"
 
-static char* _read_file(const char* path) {
+static char* _read_file(const char* path, size_t* size) {
     FILE* file = fopen(path, "rb");
     if (file == NULL) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
@@ -29,19 +40,41 @@ static char* _read_file(const char* path) {
         return NULL;
     }
     buffer[bytesRead] = '\0';
+    *size = bytesRead;
 
     fclose(file);
     return buffer;
 }
 
+static bool _is_bytecode_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    uint8_t header[sizeof(BYTECODE_MAGIC) - 1];
+    size_t bytesRead = fread(header, 1, sizeof(header), file);
+    fclose(file);
+    return l_is_bytecode(header, bytesRead);
+}
+
 int l_run_file(const char* path) {
-    char* source = _read_file(path);
+    InterpretResult result;
 
-    if ( source == NULL )
-        return 74;
+    if (_is_bytecode_file(path)) {
+        TIMELINE_BEGIN(TIMELINE_COMPILE, "load");
+        obj_function_t* function = l_load_bytecode_file(path);
+        TIMELINE_END(TIMELINE_COMPILE);
+        result = function == NULL ? INTERPRET_COMPILE_ERROR : l_interpret_function(function);
+    } else {
+        size_t size;
+        char* source = _read_file(path, &size);
+
+        if ( source == NULL )
+            return 74;
 
-    InterpretResult result = l_interpret(source);
-    free(source); 
+        result = l_interpret(source);
+        free(source); 
+    }
 
     if (result == INTERPRET_COMPILE_ERROR) 
         return 65;
@@ -49,4 +82,64 @@ int l_run_file(const char* path) {
         return 70;
 
     return 0;
-}
\ No newline at end of file
+}
+
+int l_compile_file(const char* path, const char* output) {
+    size_t size;
+    char* source = _read_file(path, &size);
+
+    if ( source == NULL )
+        return 74;
+
+    obj_function_t* function = l_compile(source);
+    free(source);
+
+    if (function == NULL)
+        return 65;
+
+    uint8_t* data;
+    if (!l_serialize_function(function, &data, &size)) {
+        fprintf(stderr, "Could not serialize \"%s\".\n", path);
+        return 65;
+    }
+
+    // Written next to the output and renamed over it. A process running
+    // the old image has it mapped and keeps the old file, rewriting it in
+    // place would truncate or change the code under it.
+    size_t length = strlen(output);
+    char* temporary = malloc(length + 32);
+    snprintf(temporary, length + 32, "%s.%d.tmp", output, (int)getpid());
+
+    FILE* file = fopen(temporary, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", temporary);
+        free(temporary);
+        free(data);
+        return 74;
+    }
+
+    size_t written = fwrite(data, 1, size, file);
+    bool closed = fclose(file) == 0;
+    free(data);
+
+    if (written < size || !closed) {
+        fprintf(stderr, "Could not write file \"%s\".\n", temporary);
+        remove(temporary);
+        free(temporary);
+        return 74;
+    }
+
+#ifdef LOX_WINDOWS
+    // rename doesn't replace an existing file here, images aren't mapped
+    remove(output);
+#endif
+    if (rename(temporary, output) != 0) {
+        fprintf(stderr, "Could not write file \"%s\".\n", output);
+        remove(temporary);
+        free(temporary);
+        return 74;
+    }
+
+    free(temporary);
+    return 0;
+}
@@ -1,6 +1,10 @@
 #ifndef LIB_FILE_H
 #define LIB_FILE_H
 
+// runs a source file, or a precompiled .loxc file
 int l_run_file(const char* path);
+// compiles the source at path and writes its bytecode to output, which is
+// replaced by a rename so processes that mapped it keep the old image
+int l_compile_file(const char* path, const char* output);
 
 #endif
\ No newline at end of file
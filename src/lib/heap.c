@@ -0,0 +1,558 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/heap.h"
+#include "lib/memory.h"
+#include "map.h"
+#include "vm.h"
+
+// node 0 stands for the VM's roots, every other node is an object
+#define SNAPSHOT_ROOT 0
+
+// longest string value written in an object's description
+#define SNAPSHOT_STRING_LENGTH 40
+
+typedef struct {
+    char label[64];
+    int  node;
+} snapshot_root_t;
+
+typedef struct {
+    obj_t**  objects;     // object of each node, NULL for the root
+    int*     first_edge;  // the references of node n are edges[first_edge[n] .. first_edge[n + 1]]
+    int      count;
+    int      capacity;
+
+    int*     edges;
+    int      edge_count;
+    int      edge_capacity;
+
+    // object to node lookup, open addressed on the object's address
+    obj_t**  keys;
+    int*     nodes;
+    int      key_capacity;
+
+    snapshot_root_t* roots;
+    int              root_count;
+    int              root_capacity;
+
+    size_t*  sizes;
+    size_t*  retained;
+} snapshot_t;
+
+typedef struct {
+    obj_string_t* name;
+    int           count;
+    size_t        bytes;
+} class_census_t;
+
+static void* _grow(void* pointer, int* capacity, size_t size) {
+    *capacity = *capacity < 64 ? 64 : *capacity * 2;
+    void* result = realloc(pointer, size * *capacity);
+    if (result == NULL) {
+        fprintf(stderr, "Out of memory taking a heap snapshot.\n");
+        exit(74);
+    }
+    return result;
+}
+
+static uint32_t _hash_pointer(obj_t* object) {
+    uint64_t address = (uint64_t)(uintptr_t)object;
+    return (uint32_t)((address >> 3) * 2654435761u);
+}
+
+static void _grow_keys(snapshot_t* snapshot) {
+    obj_t** keys = snapshot->keys;
+    int* nodes = snapshot->nodes;
+    int capacity = snapshot->key_capacity;
+
+    snapshot->key_capacity = capacity < 64 ? 64 : capacity * 2;
+    snapshot->keys = calloc(snapshot->key_capacity, sizeof(obj_t*));
+    snapshot->nodes = malloc(sizeof(int) * snapshot->key_capacity);
+    if (snapshot->keys == NULL || snapshot->nodes == NULL) {
+        fprintf(stderr, "Out of memory taking a heap snapshot.\n");
+        exit(74);
+    }
+
+    uint32_t mask = snapshot->key_capacity - 1;
+    for (int i = 0; i < capacity; i++) {
+        if (keys[i] == NULL)
+            continue;
+        uint32_t index = _hash_pointer(keys[i]) & mask;
+        while (snapshot->keys[index] != NULL)
+            index = (index + 1) & mask;
+        snapshot->keys[index] = keys[i];
+        snapshot->nodes[index] = nodes[i];
+    }
+    free(keys);
+    free(nodes);
+}
+
+static int _add_node(snapshot_t* snapshot, obj_t* object) {
+    if (snapshot->count + 1 >= snapshot->capacity) {
+        int capacity = snapshot->capacity;
+        snapshot->objects = _grow(snapshot->objects, &capacity, sizeof(obj_t*));
+        capacity = snapshot->capacity;
+        snapshot->first_edge = _grow(snapshot->first_edge, &capacity, sizeof(int));
+        snapshot->capacity = capacity;
+    }
+
+    int node = snapshot->count++;
+    snapshot->objects[node] = object;
+    return node;
+}
+
+// the object's node, added to the end of the walk the first time it's seen
+static int _node(snapshot_t* snapshot, obj_t* object) {
+    if ((snapshot->count + 1) * 4 > snapshot->key_capacity * 3)
+        _grow_keys(snapshot);
+
+    uint32_t mask = snapshot->key_capacity - 1;
+    uint32_t index = _hash_pointer(object) & mask;
+    while (snapshot->keys[index] != NULL) {
+        if (snapshot->keys[index] == object)
+            return snapshot->nodes[index];
+        index = (index + 1) & mask;
+    }
+
+    int node = _add_node(snapshot, object);
+    snapshot->keys[index] = object;
+    snapshot->nodes[index] = node;
+    return node;
+}
+
+static int _reference(snapshot_t* snapshot, obj_t* object) {
+    if (object == NULL)
+        return -1;
+
+    int node = _node(snapshot, object);
+    if (snapshot->edge_count == snapshot->edge_capacity)
+        snapshot->edges = _grow(snapshot->edges, &snapshot->edge_capacity, sizeof(int));
+    snapshot->edges[snapshot->edge_count++] = node;
+    return node;
+}
+
+static void _reference_value(snapshot_t* snapshot, value_t value) {
+    if (IS_OBJ(value))
+        _reference(snapshot, AS_OBJ(value));
+}
+
+static void _reference_array(snapshot_t* snapshot, value_array_t* array) {
+    for (int i = 0; i < array->count; i++) {
+        _reference_value(snapshot, array->values[i]);
+    }
+}
+
+static void _reference_table(snapshot_t* snapshot, table_t* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        entry_t* entry = &table->entries[i];
+        if (entry->key == NULL)
+            continue;
+        _reference(snapshot, (obj_t*)entry->key);
+        _reference_value(snapshot, entry->value);
+    }
+}
+
+static void _reference_map(snapshot_t* snapshot, map_table_t* table) {
+    for (int i = l_map_table_next(table, -1); i != -1; i = l_map_table_next(table, i)) {
+        _reference_value(snapshot, table->entries[i].key);
+        _reference_value(snapshot, table->entries[i].value);
+    }
+}
+
+// the same references the collector follows in _blacken_object
+static void _references(snapshot_t* snapshot, obj_t* object) {
+    switch (object->type) {
+        case OBJ_BOUND_METHOD: {
+            obj_bound_method_t* bound = (obj_bound_method_t*)object;
+            _reference_value(snapshot, bound->receiver);
+            _reference(snapshot, (obj_t*)bound->method);
+            break;
+        }
+        case OBJ_CLASS: {
+            obj_class_t* klass = (obj_class_t*)object;
+            _reference(snapshot, (obj_t*)klass->name);
+            _reference_table(snapshot, &klass->methods);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            obj_closure_t* closure = (obj_closure_t*)object;
+            _reference(snapshot, (obj_t*)closure->function);
+            for (int i = 0; i < closure->upvalue_count; i++) {
+                _reference(snapshot, (obj_t*)closure->upvalues[i]);
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            obj_function_t* function = (obj_function_t*)object;
+            _reference(snapshot, (obj_t*)function->name);
+            _reference_array(snapshot, &function->chunk.constants);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            obj_instance_t* instance = (obj_instance_t*)object;
+            _reference(snapshot, (obj_t*)instance->klass);
+            _reference_table(snapshot, &instance->fields);
+            break;
+        }
+        case OBJ_LIST:
+            _reference_array(snapshot, &((obj_list_t*)object)->items);
+            break;
+        case OBJ_MAP:
+            _reference_map(snapshot, &((obj_map_t*)object)->table);
+            break;
+        case OBJ_UPVALUE:
+            _reference_value(snapshot, ((obj_upvalue_t*)object)->closed);
+            break;
+        case OBJ_BUFFER:
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+            break;
+    }
+}
+
+static void _root(snapshot_t* snapshot, obj_t* object, const char* format, ...) {
+    int node = _reference(snapshot, object);
+    if (node == -1)
+        return;
+
+    if (snapshot->root_count == snapshot->root_capacity)
+        snapshot->roots = _grow(snapshot->roots, &snapshot->root_capacity, sizeof(snapshot_root_t));
+
+    snapshot_root_t* root = &snapshot->roots[snapshot->root_count++];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(root->label, sizeof(root->label), format, args);
+    va_end(args);
+    root->node = node;
+}
+
+// the same roots the collector marks in _mark_roots, the compiler's
+// roots are left out as there's nothing to compile while a script runs
+static void _roots(snapshot_t* snapshot) {
+    for (value_t* slot = vm.stack; slot < vm.stack_top; slot++) {
+        if (IS_OBJ(*slot))
+            _root(snapshot, AS_OBJ(*slot), "stack[%d]", (int)(slot - vm.stack));
+    }
+
+    for (int i = 0; i < vm.frame_count; i++) {
+        _root(snapshot, (obj_t*)vm.frames[i].closure, "frame[%d]", i);
+    }
+
+    for (obj_upvalue_t* upvalue = vm.open_upvalues;
+                                  upvalue != NULL;
+                                  upvalue = upvalue->next) {
+        _root(snapshot, (obj_t*)upvalue, "upvalue stack[%d]", (int)(upvalue->location - vm.stack));
+    }
+
+    for (int i = 0; i < vm.globals.capacity; i++) {
+        entry_t* entry = &vm.globals.entries[i];
+        if (entry->key == NULL)
+            continue;
+        _root(snapshot, (obj_t*)entry->key, "global name %.40s", entry->key->chars);
+        if (IS_OBJ(entry->value))
+            _root(snapshot, AS_OBJ(entry->value), "global %.40s", entry->key->chars);
+    }
+
+    _root(snapshot, (obj_t*)vm.init_string, "init string");
+}
+
+// Breadth first from the root, each node's references are recorded as it
+// is reached so they're contiguous in edges
+static void _walk(snapshot_t* snapshot) {
+    _add_node(snapshot, NULL);
+    snapshot->first_edge[SNAPSHOT_ROOT] = 0;
+    _roots(snapshot);
+
+    for (int node = 1; node < snapshot->count; node++) {
+        snapshot->first_edge[node] = snapshot->edge_count;
+        _references(snapshot, snapshot->objects[node]);
+    }
+    snapshot->first_edge[snapshot->count] = snapshot->edge_count;
+}
+
+static int _intersect(int* idom, int* postorder, int a, int b) {
+    while (a != b) {
+        while (postorder[a] < postorder[b])
+            a = idom[a];
+        while (postorder[b] < postorder[a])
+            b = idom[b];
+    }
+    return a;
+}
+
+// Computes the dominator tree with the iterative algorithm from Cooper,
+// Harvey and Kennedy's "A Simple, Fast Dominance Algorithm" and sums the
+// object sizes up it into retained sizes.
+static void _retained_sizes(snapshot_t* snapshot) {
+    int count = snapshot->count;
+    int* order = malloc(sizeof(int) * count);        // nodes in postorder
+    int* postorder = malloc(sizeof(int) * count);    // postorder index of each node
+    int* stack = malloc(sizeof(int) * count);
+    int* next = malloc(sizeof(int) * count);         // next edge to follow on the stack
+    int* idom = malloc(sizeof(int) * count);
+    int* first_predecessor = calloc(count + 1, sizeof(int));
+    int* predecessors = malloc(sizeof(int) * (snapshot->edge_count + 1));
+    snapshot->sizes = malloc(sizeof(size_t) * count);
+    snapshot->retained = malloc(sizeof(size_t) * count);
+
+    for (int i = 0; i < count; i++) {
+        postorder[i] = -1;
+        idom[i] = -1;
+    }
+
+    // depth first postorder
+    int visited = 0;
+    int depth = 0;
+    stack[depth] = SNAPSHOT_ROOT;
+    next[depth] = snapshot->first_edge[SNAPSHOT_ROOT];
+    postorder[SNAPSHOT_ROOT] = count;
+    while (depth >= 0) {
+        int node = stack[depth];
+        if (next[depth] < snapshot->first_edge[node + 1]) {
+            int child = snapshot->edges[next[depth]++];
+            if (postorder[child] == -1) {
+                postorder[child] = count;
+                depth++;
+                stack[depth] = child;
+                next[depth] = snapshot->first_edge[child];
+            }
+        } else {
+            postorder[node] = visited;
+            order[visited++] = node;
+            depth--;
+        }
+    }
+
+    // predecessor lists
+    for (int node = 0; node < count; node++) {
+        for (int e = snapshot->first_edge[node]; e < snapshot->first_edge[node + 1]; e++) {
+            first_predecessor[snapshot->edges[e] + 1]++;
+        }
+    }
+    for (int node = 0; node < count; node++) {
+        first_predecessor[node + 1] += first_predecessor[node];
+    }
+    memcpy(next, first_predecessor, sizeof(int) * count);
+    for (int node = 0; node < count; node++) {
+        for (int e = snapshot->first_edge[node]; e < snapshot->first_edge[node + 1]; e++) {
+            predecessors[next[snapshot->edges[e]]++] = node;
+        }
+    }
+
+    idom[SNAPSHOT_ROOT] = SNAPSHOT_ROOT;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // reverse postorder, skipping the root which is last
+        for (int i = count - 2; i >= 0; i--) {
+            int node = order[i];
+            int dominator = -1;
+            for (int p = first_predecessor[node]; p < first_predecessor[node + 1]; p++) {
+                int predecessor = predecessors[p];
+                if (idom[predecessor] == -1)
+                    continue;
+                dominator = dominator == -1 ? predecessor
+                                            : _intersect(idom, postorder, predecessor, dominator);
+            }
+            if (idom[node] != dominator) {
+                idom[node] = dominator;
+                changed = true;
+            }
+        }
+    }
+
+    for (int node = 0; node < count; node++) {
+        obj_t* object = snapshot->objects[node];
+        snapshot->sizes[node] = object == NULL ? 0 : l_object_size(object);
+        snapshot->retained[node] = snapshot->sizes[node];
+    }
+    // a node comes before its dominator in postorder
+    for (int i = 0; i < count - 1; i++) {
+        int node = order[i];
+        snapshot->retained[idom[node]] += snapshot->retained[node];
+    }
+
+    free(order);
+    free(postorder);
+    free(stack);
+    free(next);
+    free(idom);
+    free(first_predecessor);
+    free(predecessors);
+}
+
+static void _write_string(FILE* file, obj_string_t* string) {
+    fputc('"', file);
+    int length = string->length < SNAPSHOT_STRING_LENGTH ? string->length : SNAPSHOT_STRING_LENGTH;
+    for (int i = 0; i < length; i++) {
+        char c = string->chars[i];
+        switch (c) {
+            case '"':  fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\t': fputs("\\t", file); break;
+            default:
+                fputc(c < ' ' || c == 127 ? '?' : c, file);
+        }
+    }
+    if (length < string->length)
+        fputs("...", file);
+    fputc('"', file);
+}
+
+static void _write_name(FILE* file, obj_function_t* function) {
+    if (function->name == NULL)
+        fputs("<script>", file);
+    else
+        fprintf(file, "%s", function->name->chars);
+}
+
+static void _write_description(FILE* file, obj_t* object) {
+    switch (object->type) {
+        case OBJ_BOUND_METHOD:
+            _write_name(file, ((obj_bound_method_t*)object)->method->function);
+            break;
+        case OBJ_BUFFER: {
+            obj_buffer_t* buffer = (obj_buffer_t*)object;
+            fprintf(file, "%s[%d]", buffer_type_to_string[buffer->type], buffer->count);
+            break;
+        }
+        case OBJ_CLASS:
+            fprintf(file, "%s", ((obj_class_t*)object)->name->chars);
+            break;
+        case OBJ_CLOSURE:
+            _write_name(file, ((obj_closure_t*)object)->function);
+            break;
+        case OBJ_FUNCTION:
+            _write_name(file, (obj_function_t*)object);
+            break;
+        case OBJ_INSTANCE:
+            fprintf(file, "%s", ((obj_instance_t*)object)->klass->name->chars);
+            break;
+        case OBJ_LIST:
+            fprintf(file, "%d items", ((obj_list_t*)object)->items.count);
+            break;
+        case OBJ_MAP:
+            fprintf(file, "%d entries", ((obj_map_t*)object)->table.count);
+            break;
+        case OBJ_STRING:
+            _write_string(file, (obj_string_t*)object);
+            break;
+        case OBJ_UPVALUE:
+            fputs(((obj_upvalue_t*)object)->location == &((obj_upvalue_t*)object)->closed
+                    ? "closed" : "open", file);
+            break;
+        case OBJ_NATIVE:
+            fputs(((obj_native_t*)object)->name, file);
+            break;
+    }
+}
+
+static int _compare_classes(const void* a, const void* b) {
+    size_t left = ((const class_census_t*)a)->bytes;
+    size_t right = ((const class_census_t*)b)->bytes;
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+static void _write_census(FILE* file, snapshot_t* snapshot) {
+    int objects[OBJ_TYPE_COUNT] = {0};
+    size_t bytes[OBJ_TYPE_COUNT] = {0};
+
+    class_census_t* classes = NULL;
+    int class_count = 0;
+    int class_capacity = 0;
+
+    for (int node = 1; node < snapshot->count; node++) {
+        obj_t* object = snapshot->objects[node];
+        objects[object->type]++;
+        bytes[object->type] += snapshot->sizes[node];
+
+        if (object->type != OBJ_INSTANCE)
+            continue;
+
+        // classes redefined under the same name are counted together
+        obj_string_t* name = ((obj_instance_t*)object)->klass->name;
+        int i = 0;
+        while (i < class_count &&
+               (classes[i].name->length != name->length ||
+                memcmp(classes[i].name->chars, name->chars, name->length) != 0)) {
+            i++;
+        }
+        if (i == class_count) {
+            if (class_count == class_capacity)
+                classes = _grow(classes, &class_capacity, sizeof(class_census_t));
+            classes[class_count++] = (class_census_t){ .name = name, .count = 0, .bytes = 0 };
+        }
+        classes[i].count++;
+        classes[i].bytes += snapshot->sizes[node];
+    }
+
+    fprintf(file, "# census\ntype\tcount\tbytes\n");
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        if (objects[type] > 0)
+            fprintf(file, "%s\t%d\t%zu\n", obj_type_to_string[type], objects[type], bytes[type]);
+    }
+
+    qsort(classes, class_count, sizeof(class_census_t), _compare_classes);
+    fprintf(file, "# classes\nclass\tcount\tbytes\n");
+    for (int i = 0; i < class_count; i++) {
+        fprintf(file, "%s\t%d\t%zu\n", classes[i].name->chars, classes[i].count, classes[i].bytes);
+    }
+    free(classes);
+}
+
+static void _write_snapshot(FILE* file, snapshot_t* snapshot) {
+    fprintf(file, "# lox heap snapshot: %d objects, %zu bytes retained from the roots\n",
+            snapshot->count - 1,
+            snapshot->retained[SNAPSHOT_ROOT]);
+
+    _write_census(file, snapshot);
+
+    fprintf(file, "# roots\nroot\tid\n");
+    for (int i = 0; i < snapshot->root_count; i++) {
+        fprintf(file, "%s\t@%d\n", snapshot->roots[i].label, snapshot->roots[i].node);
+    }
+
+    fprintf(file, "# objects\nid\ttype\tsize\tretained\tdescription\treferences\n");
+    for (int node = 1; node < snapshot->count; node++) {
+        obj_t* object = snapshot->objects[node];
+        fprintf(file, "@%d\t%s\t%zu\t%zu\t",
+                node,
+                obj_type_to_string[object->type],
+                snapshot->sizes[node],
+                snapshot->retained[node]);
+        _write_description(file, object);
+        fputc('\t', file);
+        for (int e = snapshot->first_edge[node]; e < snapshot->first_edge[node + 1]; e++) {
+            fprintf(file, e == snapshot->first_edge[node] ? "@%d" : " @%d", snapshot->edges[e]);
+        }
+        fputc('\n', file);
+    }
+}
+
+bool l_write_heap_snapshot(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL)
+        return false;
+
+    snapshot_t snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+
+    _walk(&snapshot);
+    _retained_sizes(&snapshot);
+    _write_snapshot(file, &snapshot);
+
+    free(snapshot.objects);
+    free(snapshot.first_edge);
+    free(snapshot.edges);
+    free(snapshot.keys);
+    free(snapshot.nodes);
+    free(snapshot.roots);
+    free(snapshot.sizes);
+    free(snapshot.retained);
+
+    return fclose(file) == 0;
+}
@@ -0,0 +1,22 @@
+#ifndef LIB_HEAP_H
+#define LIB_HEAP_H
+
+#include "common.h"
+
+// Walks the object graph from the VM's roots and writes a tab separated
+// snapshot to path. The file has four sections, each starting with a
+// '#' line:
+//
+//   census   count and bytes of the reachable objects of each type
+//   classes  count and bytes of the instances of each class
+//   roots    what holds each root object: a global, stack slot, frame ...
+//   objects  every reachable object with its size, retained size and the
+//            ids of the objects it references
+//
+// The retained size of an object is the memory that would be freed if it
+// became unreachable, the sum of the sizes of the objects it dominates.
+// The snapshot doesn't allocate from the VM heap so it can be taken at
+// any point without triggering a collection.
+bool l_write_heap_snapshot(const char* path);
+
+#endif
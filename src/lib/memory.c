@@ -1,6 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 
+#include "lib/clock.h"
 #include "lib/memory.h"
+#include "coverage.h"
+#include "jit.h"
+#include "map.h"
+#include "perf.h"
+#include "timeline.h"
 #include "vm.h"
 
 #ifdef DEBUG_LOG_GC
@@ -44,14 +51,18 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     }
 
     vm.bytes_allocated += alloc_size;
+    if (vm.bytes_allocated > vm.gc_stats.peak_bytes) {
+        vm.gc_stats.peak_bytes = vm.bytes_allocated;
+    }
+
+    // only collect when growing, frees happen during the sweep
     if (newSize > oldSize) {
 #ifdef DEBUG_STRESS_GC
         l_collect_garbage();
 #endif
-    }
-
-    if (vm.bytes_allocated > vm.next_gc) {
-        l_collect_garbage();
+        if (vm.bytes_allocated > vm.next_gc) {
+            l_collect_garbage();
+        }
     }
 
     if (newSize == 0) {
@@ -173,9 +184,16 @@ static void _blacken_object(obj_t* object) {
             l_mark_table(&instance->fields);
             break;
         }
+        case OBJ_LIST:
+            l_mark_array(&((obj_list_t*)object)->items);
+            break;
+        case OBJ_MAP:
+            l_mark_map_table(&((obj_map_t*)object)->table);
+            break;
         case OBJ_UPVALUE:
             l_mark_value(((obj_upvalue_t*)object)->closed);
             break;
+        case OBJ_BUFFER:
         case OBJ_NATIVE:
         case OBJ_STRING:
         break;
@@ -192,6 +210,9 @@ static void _free_object(obj_t* object) {
         case OBJ_BOUND_METHOD:
             free_size = sizeof(obj_bound_method_t);
             break;
+        case OBJ_BUFFER:
+            free_size = sizeof(obj_buffer_t);
+            break;
         case OBJ_CLASS: {
             free_size = sizeof(obj_class_t);
             break;
@@ -208,6 +229,14 @@ static void _free_object(obj_t* object) {
             free_size = sizeof(obj_instance_t);
             break;
         }
+        case OBJ_LIST: {
+            free_size = sizeof(obj_list_t);
+            break;
+        }
+        case OBJ_MAP: {
+            free_size = sizeof(obj_map_t);
+            break;
+        }
         case OBJ_NATIVE: {
             free_size = sizeof(obj_native_t);
             break;
@@ -232,6 +261,12 @@ static void _free_object(obj_t* object) {
         case OBJ_BOUND_METHOD:
             FREE(obj_bound_method_t, object);
             break;
+        case OBJ_BUFFER: {
+            obj_buffer_t* buffer = (obj_buffer_t*)object;
+            FREE_ARRAY(uint8_t, buffer->data, buffer_element_size[buffer->type] * buffer->count);
+            FREE(obj_buffer_t, object);
+            break;
+        }
         case OBJ_CLASS: {
             obj_class_t* klass = (obj_class_t*)object;
             l_free_table(&klass->methods);
@@ -246,6 +281,10 @@ static void _free_object(obj_t* object) {
         }
         case OBJ_FUNCTION: {
             obj_function_t* function = (obj_function_t*)object;
+#ifdef LOX_JIT
+            l_jit_free_code(function);
+#endif
+            l_coverage_free_function(function);
             l_free_chunk(&function->chunk);
             FREE(obj_function_t, object);
             break;
@@ -256,13 +295,27 @@ static void _free_object(obj_t* object) {
             FREE(obj_instance_t, object);
             break;
         }
+        case OBJ_LIST: {
+            obj_list_t* list = (obj_list_t*)object;
+            l_free_value_array(&list->items);
+            FREE(obj_list_t, object);
+            break;
+        }
+        case OBJ_MAP: {
+            obj_map_t* map = (obj_map_t*)object;
+            l_free_map_table(&map->table);
+            FREE(obj_map_t, object);
+            break;
+        }
         case OBJ_NATIVE: {
             FREE(obj_native_t, object);
             break;
         }
         case OBJ_STRING: {
             obj_string_t* string = (obj_string_t*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
+            if (!string->is_mapped) {
+                FREE_ARRAY(char, string->chars, string->length + 1);
+            }
             FREE(obj_string_t, object);
             break;
         }
@@ -310,12 +363,60 @@ static void _trace_references() {
     }
 }
 
+size_t l_object_size(obj_t* object) {
+    switch (object->type) {
+        case OBJ_BOUND_METHOD:
+            return sizeof(obj_bound_method_t);
+        case OBJ_BUFFER: {
+            obj_buffer_t* buffer = (obj_buffer_t*)object;
+            return sizeof(obj_buffer_t) + buffer_element_size[buffer->type] * buffer->count;
+        }
+        case OBJ_CLASS:
+            return sizeof(obj_class_t) + 
+                   sizeof(entry_t) * ((obj_class_t*)object)->methods.capacity;
+        case OBJ_CLOSURE:
+            return sizeof(obj_closure_t) + 
+                   sizeof(obj_upvalue_t*) * ((obj_closure_t*)object)->upvalue_count;
+        case OBJ_FUNCTION: {
+            chunk_t* chunk = &((obj_function_t*)object)->chunk;
+            return sizeof(obj_function_t) + 
+                   chunk->capacity + 
+                   sizeof(line_start_t) * chunk->line_capacity + 
+                   sizeof(value_t) * chunk->constants.capacity;
+        }
+        case OBJ_INSTANCE:
+            return sizeof(obj_instance_t) + 
+                   sizeof(entry_t) * ((obj_instance_t*)object)->fields.capacity;
+        case OBJ_LIST:
+            return sizeof(obj_list_t) + 
+                   sizeof(value_t) * ((obj_list_t*)object)->items.capacity;
+        case OBJ_MAP:
+            return sizeof(obj_map_t) + 
+                   (sizeof(map_entry_t) + 1) * ((obj_map_t*)object)->table.capacity;
+        case OBJ_NATIVE:
+            return sizeof(obj_native_t);
+        case OBJ_STRING: {
+            obj_string_t* string = (obj_string_t*)object;
+            return sizeof(obj_string_t) + (string->is_mapped ? 0 : string->length + 1);
+        }
+        case OBJ_UPVALUE:
+            return sizeof(obj_upvalue_t);
+    }
+    return 0;
+}
+
 static void _sweep() {
+    gc_stats_t* stats = &vm.gc_stats;
+    memset(stats->live_objects, 0, sizeof(stats->live_objects));
+    memset(stats->live_bytes, 0, sizeof(stats->live_bytes));
+
     obj_t* previous = NULL;
     obj_t* object = vm.objects;
     while (object != NULL) {
         if (object->is_marked) {
             object->is_marked = false;
+            stats->live_objects[object->type]++;
+            stats->live_bytes[object->type] += l_object_size(object);
             previous = object;
             object = object->next;
         } else {
@@ -329,27 +430,64 @@ static void _sweep() {
             }
 
             _free_object(unreached);
+            stats->objects_reclaimed++;
         }
     }
 }
 
+static void _record_pause(gc_stats_t* stats, uint64_t pause) {
+    stats->collections++;
+    stats->total_pause += pause;
+    stats->last_pause = pause;
+    if (pause > stats->max_pause)
+        stats->max_pause = pause;
+
+    int bucket = 0;
+    for (uint64_t micros = pause / 1000; micros > 0 && bucket < GC_PAUSE_BUCKETS - 1; micros >>= 1) {
+        bucket++;
+    }
+    stats->pause_histogram[bucket]++;
+}
+
 
 void  l_collect_garbage() {
 #ifdef DEBUG_LOG_GC
     printf("-- gc begin\n");
 #endif
+#ifdef LOX_PERF
+    l_perf_gc_begin();
+#endif
+    TIMELINE_BEGIN(TIMELINE_GC, "gc");
     size_t before = vm.bytes_allocated;
+    uint64_t start = l_now_ns();
 
+    TIMELINE_BEGIN(TIMELINE_GC, "mark");
     _mark_roots();
 
     _trace_references();
 
     l_table_remove_white(&vm.strings);
+    TIMELINE_END(TIMELINE_GC);
+
+    uint64_t marked = l_now_ns();
 
+    TIMELINE_BEGIN(TIMELINE_GC, "sweep");
     _sweep();
+    TIMELINE_END(TIMELINE_GC);
 
     vm.next_gc = vm.bytes_allocated * GC_HEAP_GROW_FACTOR;
 
+    uint64_t end = l_now_ns();
+    gc_stats_t* stats = &vm.gc_stats;
+    stats->mark_time += marked - start;
+    stats->sweep_time += end - marked;
+    stats->bytes_reclaimed += before - vm.bytes_allocated;
+    _record_pause(stats, end - start);
+    TIMELINE_END(TIMELINE_GC);
+#ifdef LOX_PERF
+    l_perf_gc_end();
+#endif
+
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
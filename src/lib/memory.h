@@ -27,4 +27,7 @@ void l_mark_object(obj_t* object);
 void l_mark_value(value_t value);
 void l_free_objects();
 
+// bytes held by the object, including the arrays it owns
+size_t l_object_size(obj_t* object);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "lib/opstats.h"
+
+#ifdef DEBUG_OPCODE_STATS
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lib/debug.h"
+
+#ifdef DEBUG_OPCODE_CYCLES
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+typedef struct {
+    uint64_t counts[UINT8_COUNT];
+    uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+    int      previous; // -1 before the first instruction
+
+#ifdef DEBUG_OPCODE_CYCLES
+    uint64_t cycles[UINT8_COUNT];
+    uint64_t timed[UINT8_COUNT];
+    uint64_t started;
+    uint32_t random;   // xorshift state picking the instructions to time
+    bool     timing;   // the previous instruction is being timed
+#endif
+} opstats_t;
+
+#define OPSTATS_SEED 2463534242u
+
+static opstats_t _stats = {
+    .previous = -1,
+#ifdef DEBUG_OPCODE_CYCLES
+    .random = OPSTATS_SEED,
+#endif
+};
+
+#ifdef DEBUG_OPCODE_CYCLES
+// cycles on x86, nanoseconds elsewhere
+static inline uint64_t _now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+#endif
+}
+#endif
+
+static void _reset() {
+    memset(&_stats, 0, sizeof(_stats));
+    _stats.previous = -1;
+#ifdef DEBUG_OPCODE_CYCLES
+    _stats.random = OPSTATS_SEED;
+#endif
+}
+
+void l_opstats_record(uint8_t op) {
+#ifdef DEBUG_OPCODE_CYCLES
+    // an instruction's time runs until the next one is dispatched
+    if (_stats.timing) {
+        _stats.cycles[_stats.previous] += _now() - _stats.started;
+        _stats.timed[_stats.previous]++;
+    }
+#endif
+
+    _stats.counts[op]++;
+    if (_stats.previous >= 0)
+        _stats.pairs[_stats.previous][op]++;
+    _stats.previous = op;
+
+#ifdef DEBUG_OPCODE_CYCLES
+    // sampled at random so a loop's period can't line up with the rate
+    uint32_t random = _stats.random;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    _stats.random = random;
+    _stats.timing = random % OPSTATS_CYCLE_SAMPLE_RATE == 0;
+    if (_stats.timing)
+        _stats.started = _now();
+#endif
+}
+
+typedef struct {
+    uint64_t count;
+    uint8_t  first;
+    uint8_t  second;
+} opstats_pair_t;
+
+static int _compare_pairs(const void* a, const void* b) {
+    uint64_t countA = ((const opstats_pair_t*)a)->count;
+    uint64_t countB = ((const opstats_pair_t*)b)->count;
+    return countA < countB ? 1 : countA > countB ? -1 : 0;
+}
+
+void l_opstats_report(FILE* file) {
+    uint64_t total = 0;
+    for (int op = 0; op < UINT8_COUNT; op++) {
+        total += _stats.counts[op];
+    }
+    if (total == 0)
+        return;
+
+    // opcodes as pairs with an unused second byte so they sort the same way
+    opstats_pair_t* sorted = malloc(sizeof(opstats_pair_t) * UINT8_COUNT * UINT8_COUNT);
+    if (sorted == NULL)
+        return;
+
+    int count = 0;
+    for (int op = 0; op < UINT8_COUNT; op++) {
+        if (_stats.counts[op] > 0)
+            sorted[count++] = (opstats_pair_t){ _stats.counts[op], (uint8_t)op, 0 };
+    }
+    qsort(sorted, count, sizeof(opstats_pair_t), _compare_pairs);
+
+    fprintf(file, "== opcodes (%llu executed) ==\n", (unsigned long long)total);
+#ifdef DEBUG_OPCODE_CYCLES
+    fprintf(file, "%-20s %12s %7s %11s\n", "opcode", "count", "%", "avg cycles");
+#else
+    fprintf(file, "%-20s %12s %7s\n", "opcode", "count", "%");
+#endif
+    for (int i = 0; i < count; i++) {
+        uint8_t op = sorted[i].first;
+        fprintf(file, "%-20s %12llu %6.2f%%", l_opcode_name(op),
+                (unsigned long long)sorted[i].count, 100.0 * sorted[i].count / total);
+#ifdef DEBUG_OPCODE_CYCLES
+        if (_stats.timed[op] > 0)
+            fprintf(file, " %11.1f", (double)_stats.cycles[op] / _stats.timed[op]);
+#endif
+        fprintf(file, "\n");
+    }
+
+    count = 0;
+    for (int first = 0; first < UINT8_COUNT; first++) {
+        for (int second = 0; second < UINT8_COUNT; second++) {
+            uint64_t pairCount = _stats.pairs[first][second];
+            if (pairCount > 0)
+                sorted[count++] = (opstats_pair_t){ pairCount, (uint8_t)first, (uint8_t)second };
+        }
+    }
+    qsort(sorted, count, sizeof(opstats_pair_t), _compare_pairs);
+
+    fprintf(file, "== opcode pairs (top %d) ==\n", OPSTATS_TOP_PAIRS);
+    for (int i = 0; i < count && i < OPSTATS_TOP_PAIRS; i++) {
+        fprintf(file, "%-20s %-20s %12llu %6.2f%%\n",
+                l_opcode_name(sorted[i].first), l_opcode_name(sorted[i].second),
+                (unsigned long long)sorted[i].count, 100.0 * sorted[i].count / total);
+    }
+
+    free(sorted);
+    _reset();
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef LIB_OPSTATS_H
+#define LIB_OPSTATS_H
+
+#include "common.h"
+
+#ifdef DEBUG_OPCODE_STATS
+
+// one in this many instructions is timed when DEBUG_OPCODE_CYCLES is set
+#define OPSTATS_CYCLE_SAMPLE_RATE 64
+
+// pairs listed in the report
+#define OPSTATS_TOP_PAIRS 32
+
+// Counts the opcode and the pair it forms with the previous one, called by
+// the interpreter before each instruction. Instructions run as native code
+// by the JIT aren't seen.
+void l_opstats_record(uint8_t op);
+
+// Writes the opcode and pair counts sorted by frequency, along with the
+// sampled cycles per opcode, and clears them. The cycles include the cost
+// of reading the timestamp counter, compare them against each other
+// rather than as absolute costs.
+void l_opstats_report(FILE* file);
+
+#endif
+
+#endif
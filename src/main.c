@@ -4,6 +4,13 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "coverage.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "perf.h"
+#include "profiler.h"
+#include "serialize.h"
+#include "timeline.h"
 #include "version.h"
 #include "vm.h"
 #include "lib/debug.h"
@@ -24,6 +31,37 @@ static void _repl() {
     }
 }
 
+static bool _exists(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file != NULL)
+        fclose(file);
+    return file != NULL;
+}
+
+// The source a .loxc was compiled from, the reverse of --compile's naming:
+// script.loxc comes from script.lox, or from script when that was compiled
+// without the extension. Other paths are returned as they are. The result
+// is malloc'd.
+static char* _source_path(const char* path) {
+    size_t length = strlen(path);
+    size_t extension = strlen(BYTECODE_EXTENSION);
+    // ".lox" is shorter than the extension it replaces
+    char* source = malloc(length + 1);
+    strcpy(source, path);
+    if (length <= extension || strcmp(path + length - extension, BYTECODE_EXTENSION) != 0)
+        return source;
+
+    strcpy(source + length - extension, ".lox");
+    if (_exists(source))
+        return source;
+
+    source[length - extension] = '\0';
+    if (_exists(source))
+        return source;
+    strcpy(source + length - extension, ".lox");
+    return source;
+}
+
 int main(int argc, const char* argv[]) {
     printf("Starting lox %s ...\ncommit: %s\nbranch: %s\n", 
         VERSION,
@@ -31,19 +69,120 @@ int main(int argc, const char* argv[]) {
         BRANCH
     );
 
+    const char* path = NULL;
+    bool compile = false;
+    const char* trace = NULL;
+    const char* coverage = NULL;
+#ifdef LOX_PROFILER
+    const char* profile = NULL;
+#endif
+#ifdef LOX_PERF
+    bool perf = false;
+#endif
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-O", 2) == 0) {
+            // -O on its own enables every pass
+            const char* level = argv[i] + 2;
+            l_set_optimize_level(*level == '\0' ? OPTIMIZE_LEVEL_MAX : atoi(level));
+        } else if (strcmp(argv[i], "--jit") == 0) {
+#ifdef LOX_JIT
+            l_set_jit_enabled(true);
+#else
+            fprintf(stderr, "The JIT is not available on this platform.\n");
+#endif
+        } else if (strcmp(argv[i], "--compile") == 0) {
+            compile = true;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+#ifdef LOX_PROFILER
+            profile = argv[i] + 10;
+#else
+            fprintf(stderr, "The profiler is not available on this platform.\n");
+#endif
+        } else if (strcmp(argv[i], "--perf") == 0) {
+#ifdef LOX_PERF
+            perf = true;
+#else
+            fprintf(stderr, "Performance counters are not available on this platform.\n");
+#endif
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace = argv[i] + 8;
+        } else if (strncmp(argv[i], "--coverage=", 11) == 0) {
+            coverage = argv[i] + 11;
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: lox [-O<level>] [--jit] [--compile] [--profile=<output>] [--perf] [--trace=<output>] [--coverage=<output>] [path]\n");
+            exit(64);
+        }
+    }
+
+    if (compile && path == NULL) {
+        fprintf(stderr, "--compile needs a script to compile.\n");
+        exit(64);
+    }
+
+    if (coverage != NULL && path == NULL) {
+        fprintf(stderr, "--coverage needs a script to run.\n");
+        exit(64);
+    }
+
     l_init_vm();
 
-    if (argc == 1) {
+    if (trace != NULL && !l_timeline_start(trace)) {
+        fprintf(stderr, "Could not start the timeline.\n");
+    }
+
+    // reported against the source rather than its compiled bytecode
+    char* source = NULL;
+    if (coverage != NULL) {
+        source = path != NULL ? _source_path(path) : NULL;
+        l_start_coverage(coverage, source);
+    }
+
+#ifdef LOX_PROFILER
+    if (profile != NULL && !l_start_profiler(profile)) {
+        fprintf(stderr, "Could not start the profiler.\n");
+    }
+#endif
+
+#ifdef LOX_PERF
+    // l_start_perf explains why when the counters can't be opened
+    if (perf)
+        l_start_perf();
+#endif
+
+    int status = 0;
+    if (compile) {
+        // script.lox is written to script.loxc
+        size_t length = strlen(path);
+        bool lox = length >= 4 && strcmp(path + length - 4, ".lox") == 0;
+        char* output = malloc(length + sizeof(BYTECODE_EXTENSION));
+        memcpy(output, path, length);
+        strcpy(output + length - (lox ? 4 : 0), BYTECODE_EXTENSION);
+
+        status = l_compile_file(path, output);
+        free(output);
+    } else if (path == NULL) {
         _repl();
-    } else if (argc == 2) {
-        int status = l_run_file(argv[1]);
-        if (status != 0)
-            exit(status);
     } else {
-        fprintf(stderr, "Usage: lox [path]\n");
-        exit(64);
+        status = l_run_file(path);
     }
 
+    l_timeline_stop();
+    l_stop_coverage();
+    free(source);
+
+#ifdef LOX_PROFILER
+    l_stop_profiler();
+#endif
+
+#ifdef LOX_PERF
+    l_stop_perf(stderr);
+#endif
+
+    if (status != 0)
+        exit(status);
+
     l_free_vm();
     
     printf("Exiting lox ...\n");
@@ -0,0 +1,178 @@
+#include <string.h>
+
+#include "lib/memory.h"
+#include "map.h"
+#include "object.h"
+#include "value.h"
+
+#define MAP_MAX_LOAD 0.75
+
+#define CONTROL_EMPTY     0x00
+#define CONTROL_TOMBSTONE 0x01
+#define CONTROL_FULL      0x80
+
+#define CONTROL_TAG(hash) (CONTROL_FULL | ((hash) & 0x7f))
+
+void l_init_map_table(map_table_t* table) {
+    table->count = 0;
+    table->used = 0;
+    table->capacity = 0;
+    table->control = NULL;
+    table->entries = NULL;
+}
+
+void l_free_map_table(map_table_t* table) {
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(map_entry_t, table->entries, table->capacity);
+    l_init_map_table(table);
+}
+
+static uint32_t _hash_bits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdull;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+uint32_t l_hash_value(value_t value) {
+    switch (value.type) {
+        case VAL_BOOL:   return AS_BOOL(value) ? 3 : 5;
+        case VAL_NIL:    return 7;
+        case VAL_NUMBER: {
+            double number = AS_NUMBER(value);
+            // -0 and 0 compare equal so they must hash the same
+            if (number == 0)
+                number = 0;
+            uint64_t bits;
+            memcpy(&bits, &number, sizeof(bits));
+            return _hash_bits(bits);
+        }
+        case VAL_OBJ:
+            if (IS_STRING(value))
+                return AS_STRING(value)->hash;
+            return _hash_bits((uint64_t)(uintptr_t)AS_OBJ(value));
+        default:
+            return 0;
+    }
+}
+
+// Returns the slot holding key, or the slot where it should be inserted
+static int _find_slot(uint8_t* control, map_entry_t* entries, int capacity,
+                      value_t key, uint32_t hash) {
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t index = hash & mask;
+    uint8_t  tag = CONTROL_TAG(hash);
+    int      tombstone = -1;
+
+    for (;;) {
+        uint8_t state = control[index];
+        if (state == CONTROL_EMPTY) {
+            return tombstone != -1 ? tombstone : (int)index;
+        } 
+        else if (state == CONTROL_TOMBSTONE) {
+            if (tombstone == -1)
+                tombstone = (int)index;
+        } 
+        else if (state == tag && l_values_equal(entries[index].key, key)) {
+            return (int)index;
+        }
+
+        index = (index + 1) & mask;
+    }
+}
+
+bool l_map_table_get(map_table_t* table, value_t key, value_t* value) {
+    if (table->count == 0)
+        return false;
+
+    uint32_t hash = l_hash_value(key);
+    int slot = _find_slot(table->control, table->entries, table->capacity, key, hash);
+    if ((table->control[slot] & CONTROL_FULL) == 0)
+        return false;
+
+    *value = table->entries[slot].value;
+    return true;
+}
+
+static void _adjust_capacity(map_table_t* table, int capacity) {
+    uint8_t*     control = ALLOCATE(uint8_t, capacity);
+    map_entry_t* entries = ALLOCATE(map_entry_t, capacity);
+    memset(control, CONTROL_EMPTY, capacity);
+
+    for (int i = 0; i < table->capacity; i++) {
+        if ((table->control[i] & CONTROL_FULL) == 0)
+            continue;
+
+        map_entry_t* entry = &table->entries[i];
+        uint32_t hash = l_hash_value(entry->key);
+        int slot = _find_slot(control, entries, capacity, entry->key, hash);
+        control[slot] = CONTROL_TAG(hash);
+        entries[slot] = *entry;
+    }
+
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
+    FREE_ARRAY(map_entry_t, table->entries, table->capacity);
+
+    // tombstones are dropped when rehashing
+    table->used = table->count;
+    table->control = control;
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+bool l_map_table_set(map_table_t* table, value_t key, value_t value) {
+    if (table->used + 1 > table->capacity * MAP_MAX_LOAD) {
+        int capacity = GROW_CAPACITY(table->capacity);
+        _adjust_capacity(table, capacity);
+    }
+
+    uint32_t hash = l_hash_value(key);
+    int slot = _find_slot(table->control, table->entries, table->capacity, key, hash);
+    uint8_t state = table->control[slot];
+    bool isNewKey = (state & CONTROL_FULL) == 0;
+
+    if (isNewKey) {
+        table->count++;
+        if (state == CONTROL_EMPTY)
+            table->used++;
+    }
+
+    table->control[slot] = CONTROL_TAG(hash);
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    return isNewKey;
+}
+
+bool l_map_table_delete(map_table_t* table, value_t key) {
+    if (table->count == 0)
+        return false;
+
+    uint32_t hash = l_hash_value(key);
+    int slot = _find_slot(table->control, table->entries, table->capacity, key, hash);
+    if ((table->control[slot] & CONTROL_FULL) == 0)
+        return false;
+
+    table->control[slot] = CONTROL_TOMBSTONE;
+    table->entries[slot].key = NIL_VAL;
+    table->entries[slot].value = NIL_VAL;
+    table->count--;
+    return true;
+}
+
+int l_map_table_next(map_table_t* table, int index) {
+    for (int i = index + 1; i < table->capacity; i++) {
+        if (table->control[i] & CONTROL_FULL)
+            return i;
+    }
+    return -1;
+}
+
+void l_mark_map_table(map_table_t* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        if ((table->control[i] & CONTROL_FULL) == 0)
+            continue;
+
+        l_mark_value(table->entries[i].key);
+        l_mark_value(table->entries[i].value);
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef LOX_MAP_H
+#define LOX_MAP_H
+
+#include "common.h"
+#include "value.h"
+
+typedef struct {
+    value_t key;
+    value_t value;
+} map_entry_t;
+
+// Open addressing hash table keyed by any value_t. Each slot has a
+// control byte holding its state and 7 bits of the key's hash so that
+// most mismatching slots are skipped without comparing keys.
+typedef struct {
+    int          count;
+    int          used;
+    int          capacity;
+    uint8_t*     control;
+    map_entry_t* entries;
+} map_table_t;
+
+void l_init_map_table(map_table_t* table);
+void l_free_map_table(map_table_t* table);
+
+bool l_map_table_get(map_table_t* table, value_t key, value_t* value);
+bool l_map_table_set(map_table_t* table, value_t key, value_t value);
+bool l_map_table_delete(map_table_t* table, value_t key);
+
+uint32_t l_hash_value(value_t value);
+
+// iteration, returns the next occupied slot index after 'index' or -1
+int l_map_table_next(map_table_t* table, int index);
+
+// garbage collection
+void l_mark_map_table(map_table_t* table);
+
+#endif
@@ -30,6 +30,18 @@ obj_bound_method_t* l_new_bound_method(value_t receiver, obj_closure_t* method)
     return bound;
 }
 
+obj_buffer_t* l_new_buffer(BufferType type, int count) {
+    size_t size = buffer_element_size[type] * count;
+    uint8_t* data = ALLOCATE(uint8_t, size);
+    memset(data, 0, size);
+
+    obj_buffer_t* buffer = ALLOCATE_OBJ(obj_buffer_t, OBJ_BUFFER);
+    buffer->type = type;
+    buffer->count = count;
+    buffer->data = data;
+    return buffer;
+}
+
 obj_class_t* l_new_class(obj_string_t* name) {
     obj_class_t* klass = ALLOCATE_OBJ(obj_class_t, OBJ_CLASS);
     klass->name = name;
@@ -44,6 +56,18 @@ obj_instance_t* l_new_instance(obj_class_t* klass) {
     return instance;
 }
 
+obj_list_t* l_new_list() {
+    obj_list_t* list = ALLOCATE_OBJ(obj_list_t, OBJ_LIST);
+    l_init_value_array(&list->items);
+    return list;
+}
+
+obj_map_t* l_new_map() {
+    obj_map_t* map = ALLOCATE_OBJ(obj_map_t, OBJ_MAP);
+    l_init_map_table(&map->table);
+    return map;
+}
+
 obj_closure_t* l_new_closure(obj_function_t* function) {
     obj_upvalue_t** upvalues = ALLOCATE(obj_upvalue_t*, function->upvalue_count);
     for (int i = 0; i < function->upvalue_count; i++) {
@@ -63,12 +87,19 @@ obj_function_t* l_new_function() {
     function->arity = 0;
     function->upvalue_count = 0;
     function->name = NULL;
+    function->inline_kind = INLINE_NONE;
+    function->call_count = 0;
+    function->jit = NULL;
+    function->loop_hotness = NULL;
+    function->traces = NULL;
+    function->coverage = NULL;
     l_init_chunk(&function->chunk);
     return function;
 }
 
-obj_native_t* l_new_native(native_func_t function) {
+obj_native_t* l_new_native(const char* name, native_func_t function) {
     obj_native_t* native = ALLOCATE_OBJ(obj_native_t, OBJ_NATIVE);
+    native->name = name;
     native->function = function;
     return native;
 }
@@ -78,9 +109,8 @@ static obj_string_t* _allocate_string(char* chars, int length, uint32_t hash) {
     string->length = length;
     string->chars = chars;
     string->hash = hash;
-    l_push(OBJ_VAL(string));
-    l_table_set(&vm.strings, string, NIL_VAL);
-    l_pop();
+    string->is_interned = false;
+    string->is_mapped = false;
     return string;
 }
 
@@ -93,20 +123,49 @@ static uint32_t _hash_string(const char* key, int length) {
 return hash;
 }
 
+// Strings are created un-interned. They only enter vm.strings when
+// l_intern_string is called, i.e. when they are used as a table key.
 obj_string_t* l_take_string(char* chars, int length) {
     uint32_t hash = _hash_string(chars, length);
-
-    obj_string_t* interned = l_table_find_string(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
     return _allocate_string(chars, length, hash);
 }
 
 obj_string_t* l_copy_string(const char* chars, int length) {
     uint32_t hash = _hash_string(chars, length);
 
+    char* heapChars = ALLOCATE(char, length + 1);
+    memcpy(heapChars, chars, length);
+    heapChars[length] = '\0';
+    return _allocate_string(heapChars, length, hash);
+}
+
+static obj_string_t* _intern(obj_string_t* string) {
+    l_push(OBJ_VAL(string));
+    l_table_set(&vm.strings, string, NIL_VAL);
+    l_pop();
+    string->is_interned = true;
+    return string;
+}
+
+obj_string_t* l_intern_string(obj_string_t* string) {
+    if (string->is_interned)
+        return string;
+
+    obj_string_t* interned = l_table_find_string(&vm.strings, 
+                                                 string->chars, 
+                                                 string->length, 
+                                                 string->hash);
+    if (interned != NULL) 
+        return interned;
+
+    return _intern(string);
+}
+
+// Hashes the characters once and only allocates when the string
+// hasn't been interned yet.
+obj_string_t* l_copy_interned_string(const char* chars, int length) {
+    uint32_t hash = _hash_string(chars, length);
+
     obj_string_t* interned = l_table_find_string(&vm.strings, chars, length, hash);
     if (interned != NULL) 
         return interned;
@@ -114,7 +173,34 @@ obj_string_t* l_copy_string(const char* chars, int length) {
     char* heapChars = ALLOCATE(char, length + 1);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return _allocate_string(heapChars, length, hash);
+    return _intern(_allocate_string(heapChars, length, hash));
+}
+
+obj_string_t* l_mapped_string(const char* chars, int length, uint32_t hash) {
+    // interned under the wrong hash it would be a second copy of the text
+    if (hash != _hash_string(chars, length))
+        return NULL;
+
+    obj_string_t* interned = l_table_find_string(&vm.strings, chars, length, hash);
+    if (interned != NULL) 
+        return interned;
+
+    obj_string_t* string = _allocate_string((char*)chars, length, hash);
+    string->is_mapped = true;
+    return _intern(string);
+}
+
+bool l_strings_equal(obj_string_t* a, obj_string_t* b) {
+    if (a == b)
+        return true;
+
+    // two distinct interned strings can never have the same content
+    if (a->is_interned && b->is_interned)
+        return false;
+
+    return a->length == b->length &&
+           a->hash == b->hash &&
+           memcmp(a->chars, b->chars, a->length) == 0;
 }
 
 obj_upvalue_t*  l_new_upvalue(value_t* slot) {
@@ -133,11 +219,41 @@ static void _print_function(obj_function_t* function) {
     printf("<fn %s>", function->name->chars);
 }
 
+static void _print_list(obj_list_t* list) {
+    printf("[");
+    for (int i = 0; i < list->items.count; i++) {
+        if (i > 0)
+            printf(", ");
+        l_print_value(list->items.values[i]);
+    }
+    printf("]");
+}
+
+static void _print_map(obj_map_t* map) {
+    printf("{");
+    bool first = true;
+    for (int i = l_map_table_next(&map->table, -1); i != -1; 
+             i = l_map_table_next(&map->table, i)) {
+        if (!first)
+            printf(", ");
+        first = false;
+        l_print_value(map->table.entries[i].key);
+        printf(": ");
+        l_print_value(map->table.entries[i].value);
+    }
+    printf("}");
+}
+
 void l_print_object(value_t value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_BOUND_METHOD:
             _print_function(AS_BOUND_METHOD(value)->method->function);
             break;
+        case OBJ_BUFFER:
+            printf("<buffer %s x %d>", 
+                buffer_type_to_string[AS_BUFFER(value)->type],
+                AS_BUFFER(value)->count);
+            break;
         case OBJ_CLASS:
             printf("class %s", AS_CLASS(value)->name->chars);
         break;
@@ -150,6 +266,12 @@ void l_print_object(value_t value) {
         case OBJ_INSTANCE:
             printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
             break;
+        case OBJ_LIST:
+            _print_list(AS_LIST(value));
+            break;
+        case OBJ_MAP:
+            _print_map(AS_MAP(value));
+            break;
         case OBJ_NATIVE:
             printf("<native fn>");
             break;
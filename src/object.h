@@ -3,45 +3,60 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "map.h"
 #include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value)   (AS_OBJ(value)->type)
 
 #define IS_BOUND_METHOD(value) l_is_obj_type(value, OBJ_BOUND_METHOD)
+#define IS_BUFFER(value)       l_is_obj_type(value, OBJ_BUFFER)
 #define IS_CLASS(value)        l_is_obj_type(value, OBJ_CLASS)
 #define IS_CLOSURE(value)      l_is_obj_type(value, OBJ_CLOSURE)
 #define IS_FUNCTION(value)     l_is_obj_type(value, OBJ_FUNCTION)
 #define IS_INSTANCE(value)     l_is_obj_type(value, OBJ_INSTANCE)
+#define IS_LIST(value)         l_is_obj_type(value, OBJ_LIST)
+#define IS_MAP(value)          l_is_obj_type(value, OBJ_MAP)
 #define IS_NATIVE(value)       l_is_obj_type(value, OBJ_NATIVE)
 #define IS_STRING(value)       l_is_obj_type(value, OBJ_STRING)
 
 #define AS_BOUND_METHOD(value) ((obj_bound_method_t*)AS_OBJ(value))
+#define AS_BUFFER(value)       ((obj_buffer_t*)AS_OBJ(value))
 #define AS_CLASS(value)        ((obj_class_t*)AS_OBJ(value))
 #define AS_CLOSURE(value)      ((obj_closure_t*)AS_OBJ(value))
 #define AS_FUNCTION(value)     ((obj_function_t*)AS_OBJ(value))
 #define AS_INSTANCE(value)     ((obj_instance_t*)AS_OBJ(value))
+#define AS_LIST(value)         ((obj_list_t*)AS_OBJ(value))
+#define AS_MAP(value)          ((obj_map_t*)AS_OBJ(value))
 #define AS_NATIVE(value)       (((obj_native_t*)AS_OBJ(value))->function)
 #define AS_STRING(value)       ((obj_string_t*)AS_OBJ(value))
 #define AS_CSTRING(value)      (((obj_string_t*)AS_OBJ(value))->chars)
 
 typedef enum {
     OBJ_BOUND_METHOD,
+    OBJ_BUFFER,
     OBJ_CLASS,
     OBJ_CLOSURE,
     OBJ_FUNCTION,
     OBJ_INSTANCE,
+    OBJ_LIST,
+    OBJ_MAP,
     OBJ_NATIVE,
     OBJ_STRING,
     OBJ_UPVALUE,
 } ObjType;
 
+#define OBJ_TYPE_COUNT (OBJ_UPVALUE + 1)
+
 static char* obj_type_to_string[] = {
     "Bound Method",
+    "Buffer",
     "Class",
     "Closure",
     "Function",
     "Instance",
+    "List",
+    "Map",
     "Native function",
     "String",
     "Upvalue",
@@ -53,18 +68,49 @@ struct obj_t{
     struct obj_t* next;
 };
 
+// Small leaf functions whose whole body matches one of these shapes are
+// evaluated by the VM without pushing a call frame.
+typedef enum {
+    INLINE_NONE,
+    INLINE_CONSTANT,  // return <op>, op is NIL, TRUE, FALSE or CONSTANT a
+    INLINE_PARAMETER, // return slot a
+    INLINE_GETTER,    // return this.<constant a>
+    INLINE_SETTER,    // a stores of this.<constant> = slot, returns nil or this when b is set
+    INLINE_BINARY_LL, // return slot a <op> slot b
+    INLINE_BINARY_LK, // return slot a <op> constant b
+} InlineKind;
+
+typedef struct jit_code_t jit_code_t;
+typedef struct jit_trace_t jit_trace_t;
+typedef struct coverage_t coverage_t;
+
 typedef struct {
     obj_t obj;
     int   arity;
     int   upvalue_count;
     chunk_t chunk;
     obj_string_t* name;
+
+    InlineKind inline_kind;
+    uint8_t    inline_op;
+    uint8_t    inline_a;
+    uint8_t    inline_b;
+
+    // calls counted until the function is compiled to native code
+    int          call_count;
+    jit_code_t*  jit;
+    // back edges counted per loop header until the loop is traced
+    uint16_t*    loop_hotness;
+    jit_trace_t* traces;
+    // the original code of instructions patched for coverage
+    coverage_t*  coverage;
 } obj_function_t;
 
 typedef value_t (*native_func_t)(int argCount, value_t *args);
 
 typedef struct {
     obj_t         obj;
+    const char*   name;  // the name it was defined with, not owned
     native_func_t function;
 } obj_native_t;
 
@@ -73,6 +119,8 @@ struct obj_string_t {
     int      length;
     char*    chars;
     uint32_t hash;
+    bool     is_interned;
+    bool     is_mapped;   // chars point into a bytecode image, not the heap
 };
 
 typedef struct obj_upvalue_t obj_upvalue_t;
@@ -103,6 +151,45 @@ typedef struct {
     table_t      fields;
 } obj_instance_t;
 
+typedef struct {
+    obj_t         obj;
+    value_array_t items;
+} obj_list_t;
+
+typedef struct {
+    obj_t       obj;
+    map_table_t table;
+} obj_map_t;
+
+typedef enum {
+    BUFFER_FLOAT64,
+    BUFFER_FLOAT32,
+    BUFFER_INT32,
+    BUFFER_UINT8,
+} BufferType;
+
+static char* buffer_type_to_string[] = {
+    "f64",
+    "f32",
+    "i32",
+    "u8",
+};
+
+static const size_t buffer_element_size[] = {
+    sizeof(double),
+    sizeof(float),
+    sizeof(int32_t),
+    sizeof(uint8_t),
+};
+
+// Compact storage for numeric data, elements are stored unboxed
+typedef struct {
+    obj_t      obj;
+    BufferType type;
+    int        count;
+    void*      data;
+} obj_buffer_t;
+
 typedef struct {
     obj_t obj;
     value_t receiver;
@@ -110,16 +197,27 @@ typedef struct {
 } obj_bound_method_t;
 
 obj_bound_method_t* l_new_bound_method(value_t receiver, obj_closure_t* method);
+obj_buffer_t*       l_new_buffer(BufferType type, int count);
 obj_class_t*        l_new_class(obj_string_t* name);
 obj_closure_t*      l_new_closure(obj_function_t* function);
 obj_function_t*     l_new_function();
 obj_instance_t*     l_new_instance(obj_class_t* klass);
-obj_native_t*       l_new_native(native_func_t function);
+obj_list_t*         l_new_list();
+obj_map_t*          l_new_map();
+obj_native_t*       l_new_native(const char* name, native_func_t function);
 obj_string_t*       l_take_string(char* chars, int length);
 obj_string_t*       l_copy_string(const char* chars, int length);
+// Interns a string whose NUL terminated characters live in memory that
+// outlives the VM's objects, such as a mapped bytecode image. The
+// characters are used in place when the string isn't interned yet.
+// Returns NULL if hash, which the image stores, isn't the characters' own.
+obj_string_t*       l_mapped_string(const char* chars, int length, uint32_t hash);
+obj_string_t*       l_intern_string(obj_string_t* string);
+obj_string_t*       l_copy_interned_string(const char* chars, int length);
 obj_upvalue_t*      l_new_upvalue(value_t* slot);
 
 void l_print_object(value_t value);
+bool l_strings_equal(obj_string_t* a, obj_string_t* b);
 
 static inline bool l_is_obj_type(value_t value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -0,0 +1,472 @@
+#include <string.h>
+
+#include "lib/memory.h"
+#include "optimizer.h"
+#include "timeline.h"
+
+// The optimizer lifts a compiled chunk into a list of decoded instructions
+// where jumps refer to their target instruction rather than a byte offset.
+// Passes can then remove and rewrite instructions freely, and the list is
+// lowered back into bytecode with the jump offsets recalculated.
+
+#define MAX_PASS_ROUNDS  8
+#define MAX_THREAD_DEPTH 16
+
+typedef struct {
+    uint8_t        op;
+    int            length;       // encoded length including operands
+    const uint8_t* operands;     // operand bytes in the original chunk
+    uint8_t        rewritten[4]; // operand bytes of rewritten instructions
+    int            line;
+    int            target;       // jump target instruction, -1 if not a jump
+    int            target_count; // number of live jumps landing here
+    bool           removed;
+} ir_instruction_t;
+
+typedef struct {
+    obj_function_t*   function;
+    ir_instruction_t* code;
+    int               count;
+} ir_function_t;
+
+typedef bool (*ir_pass_func)(ir_function_t* ir);
+
+typedef struct {
+    const char*  name;
+    int          level;
+    ir_pass_func run;
+} ir_pass_t;
+
+static int _optimize_level = 0;
+
+void l_set_optimize_level(int level) {
+    if (level < 0)
+        level = 0;
+    if (level > OPTIMIZE_LEVEL_MAX)
+        level = OPTIMIZE_LEVEL_MAX;
+    _optimize_level = level;
+}
+
+int l_get_optimize_level() {
+    return _optimize_level;
+}
+
+static bool _is_jump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_LOOP;
+}
+
+static int _next_live(ir_function_t* ir, int index) {
+    while (index < ir->count && ir->code[index].removed) {
+        index++;
+    }
+    return index;
+}
+
+static bool _lift(ir_function_t* ir, obj_function_t* function) {
+    chunk_t* chunk = &function->chunk;
+
+    ir->function = function;
+    ir->code = ALLOCATE(ir_instruction_t, chunk->count);
+    ir->count = 0;
+
+    // byte offset -> instruction index
+    int* indices = ALLOCATE(int, chunk->count);
+    for (int offset = 0; offset < chunk->count;) {
+        ir_instruction_t* instruction = &ir->code[ir->count];
+        instruction->op = chunk->code[offset];
+        instruction->length = l_instruction_length(chunk, offset);
+        instruction->operands = &chunk->code[offset + 1];
+        instruction->line = l_get_line(chunk, offset);
+        instruction->target = -1;
+        instruction->target_count = 0;
+        instruction->removed = false;
+
+        indices[offset] = ir->count++;
+        offset += instruction->length;
+    }
+
+    bool valid = true;
+    for (int i = 0, offset = 0; i < ir->count; offset += ir->code[i].length, i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        if (!_is_jump(instruction->op))
+            continue;
+
+        int jump = (instruction->operands[0] << 8) | instruction->operands[1];
+        int target = instruction->op == OP_LOOP ? offset + 3 - jump
+                                                : offset + 3 + jump;
+        if (target < 0 || target >= chunk->count) {
+            valid = false;
+            break;
+        }
+        instruction->target = indices[target];
+    }
+
+    FREE_ARRAY(int, indices, chunk->count);
+    return valid;
+}
+
+// Redirects jumps away from removed instructions and recounts the number
+// of jumps landing on each instruction.
+static void _resolve_targets(ir_function_t* ir) {
+    for (int i = 0; i < ir->count; i++) {
+        ir->code[i].target_count = 0;
+    }
+
+    for (int i = 0; i < ir->count; i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        if (instruction->removed || !_is_jump(instruction->op))
+            continue;
+
+        instruction->target = _next_live(ir, instruction->target);
+        if (instruction->target < ir->count)
+            ir->code[instruction->target].target_count++;
+    }
+}
+
+static bool _constant_value(ir_function_t* ir, ir_instruction_t* instruction, value_t* value) {
+    switch (instruction->op) {
+        case OP_NIL:   *value = NIL_VAL; return true;
+        case OP_TRUE:  *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        case OP_CONSTANT:
+            *value = ir->function->chunk.constants.values[instruction->operands[0]];
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Pass: constant propagation
+// Constants that flow straight into a conditional jump decide the branch at
+// compile time, and constants that are immediately popped are removed.
+static bool _constant_propagation(ir_function_t* ir) {
+    bool changed = false;
+
+    for (int i = 0; i < ir->count; i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        value_t value;
+        if (instruction->removed || !_constant_value(ir, instruction, &value))
+            continue;
+
+        int next = _next_live(ir, i + 1);
+        if (next >= ir->count || ir->code[next].target_count > 0)
+            continue;
+
+        ir_instruction_t* user = &ir->code[next];
+        if (user->op == OP_POP) {
+            instruction->removed = true;
+            user->removed = true;
+            changed = true;
+        }
+        else if (user->op == OP_JUMP_IF_FALSE) {
+            bool falsey = IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+            if (falsey) {
+                user->op = OP_JUMP;
+            } else {
+                user->removed = true;
+            }
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+// Pass: jump threading
+// Jumps that land on another jump are pointed at the final destination.
+static bool _jump_threading(ir_function_t* ir) {
+    bool changed = false;
+
+    for (int i = 0; i < ir->count; i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        if (instruction->removed || !_is_jump(instruction->op))
+            continue;
+
+        int target = instruction->target;
+        for (int depth = 0; depth < MAX_THREAD_DEPTH && target < ir->count; depth++) {
+            ir_instruction_t* next = &ir->code[target];
+            int nextTarget;
+
+            if (next->op == OP_JUMP || next->op == OP_LOOP) {
+                nextTarget = next->target;
+            }
+            else if (next->op == OP_JUMP_IF_FALSE && instruction->op == OP_JUMP_IF_FALSE) {
+                // the tested value is still on the stack, so the second
+                // jump is taken whenever the first one is
+                nextTarget = next->target;
+            }
+            else {
+                break;
+            }
+
+            // conditional jumps can only be encoded forwards
+            if (nextTarget == target ||
+                (instruction->op == OP_JUMP_IF_FALSE && nextTarget <= i)) {
+                break;
+            }
+            target = nextTarget;
+        }
+
+        if (target != instruction->target) {
+            instruction->target = target;
+            changed = true;
+        }
+
+        if (instruction->op == OP_JUMP || instruction->op == OP_LOOP) {
+            instruction->op = target <= i ? OP_LOOP : OP_JUMP;
+        }
+    }
+
+    return changed;
+}
+
+// Pass: dead code elimination
+// Removes instructions that can't be reached from the function entry and
+// jumps to the instruction that follows them.
+static bool _dead_code_elimination(ir_function_t* ir) {
+    bool changed = false;
+
+    bool* reachable = ALLOCATE(bool, ir->count);
+    int*  worklist = ALLOCATE(int, ir->count);
+    int   worklistCount = 0;
+    memset(reachable, 0, sizeof(bool) * ir->count);
+
+    int entry = _next_live(ir, 0);
+    if (entry < ir->count) {
+        reachable[entry] = true;
+        worklist[worklistCount++] = entry;
+    }
+
+    while (worklistCount > 0) {
+        int i = worklist[--worklistCount];
+        ir_instruction_t* instruction = &ir->code[i];
+
+        int successors[2];
+        int successorCount = 0;
+
+        if (_is_jump(instruction->op))
+            successors[successorCount++] = instruction->target;
+
+        if (instruction->op != OP_JUMP &&
+            instruction->op != OP_LOOP &&
+            instruction->op != OP_RETURN) {
+            successors[successorCount++] = _next_live(ir, i + 1);
+        }
+
+        for (int s = 0; s < successorCount; s++) {
+            int successor = successors[s];
+            if (successor < ir->count && !reachable[successor]) {
+                reachable[successor] = true;
+                worklist[worklistCount++] = successor;
+            }
+        }
+    }
+
+    for (int i = 0; i < ir->count; i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        if (instruction->removed)
+            continue;
+
+        if (!reachable[i]) {
+            instruction->removed = true;
+            changed = true;
+        }
+        else if ((instruction->op == OP_JUMP || instruction->op == OP_JUMP_IF_FALSE) &&
+                  instruction->target == _next_live(ir, i + 1)) {
+            instruction->removed = true;
+            changed = true;
+        }
+    }
+
+    FREE_ARRAY(int, worklist, ir->count);
+    FREE_ARRAY(bool, reachable, ir->count);
+    return changed;
+}
+
+static bool _is_register_operator(uint8_t op) {
+    switch (op) {
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns the index of the live instruction after index if it has the
+// given opcode and no jumps land on it, otherwise -1.
+static int _follows(ir_function_t* ir, int index, uint8_t op) {
+    int next = _next_live(ir, index + 1);
+    if (next >= ir->count ||
+        ir->code[next].op != op ||
+        ir->code[next].target_count > 0) {
+        return -1;
+    }
+    return next;
+}
+
+// Pass: register selection
+// Binary operations whose operands are locals or constants read them
+// straight from their slots instead of pushing copies onto the stack, and
+// results assigned straight back to a local are stored without touching
+// the stack at all:
+//   GET_LOCAL a, GET_LOCAL b, ADD                  -> BINARY_LL ADD a b
+//   GET_LOCAL a, CONSTANT k, ADD, SET_LOCAL d, POP -> STORE_BINARY_LK ADD d a k
+static bool _register_selection(ir_function_t* ir) {
+    bool changed = false;
+
+    for (int i = 0; i < ir->count; i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        if (instruction->removed || instruction->op != OP_GET_LOCAL)
+            continue;
+
+        bool constant = false;
+        int operand = _follows(ir, i, OP_GET_LOCAL);
+        if (operand < 0) {
+            operand = _follows(ir, i, OP_CONSTANT);
+            constant = true;
+        }
+        if (operand < 0)
+            continue;
+
+        int binary = _next_live(ir, operand + 1);
+        if (binary >= ir->count ||
+            !_is_register_operator(ir->code[binary].op) ||
+            ir->code[binary].target_count > 0) {
+            continue;
+        }
+
+        uint8_t op = ir->code[binary].op;
+        uint8_t a = instruction->operands[0];
+        uint8_t b = ir->code[operand].operands[0];
+
+        int store = _follows(ir, binary, OP_SET_LOCAL);
+        int pop = store >= 0 ? _follows(ir, store, OP_POP) : -1;
+
+        if (pop >= 0) {
+            instruction->op = constant ? OP_STORE_BINARY_LK : OP_STORE_BINARY_LL;
+            instruction->length = 5;
+            instruction->rewritten[0] = op;
+            instruction->rewritten[1] = ir->code[store].operands[0];
+            instruction->rewritten[2] = a;
+            instruction->rewritten[3] = b;
+            ir->code[store].removed = true;
+            ir->code[pop].removed = true;
+        } else {
+            instruction->op = constant ? OP_BINARY_LK : OP_BINARY_LL;
+            instruction->length = 4;
+            instruction->rewritten[0] = op;
+            instruction->rewritten[1] = a;
+            instruction->rewritten[2] = b;
+        }
+
+        instruction->operands = instruction->rewritten;
+        ir->code[operand].removed = true;
+        ir->code[binary].removed = true;
+        changed = true;
+    }
+
+    return changed;
+}
+
+static ir_pass_t _passes[] = {
+    {"constant-propagation",  2, _constant_propagation},
+    {"jump-threading",        1, _jump_threading},
+    {"dead-code-elimination", 1, _dead_code_elimination},
+    {"register-selection",    3, _register_selection},
+};
+
+// Re-emits the live instructions, returns false if a jump no longer fits
+// in its 16 bit operand in which case the chunk is left untouched.
+static bool _lower(ir_function_t* ir, chunk_t* chunk) {
+    int* offsets = ALLOCATE(int, ir->count);
+    int  offset = 0;
+    for (int i = 0; i < ir->count; i++) {
+        offsets[i] = offset;
+        if (!ir->code[i].removed)
+            offset += ir->code[i].length;
+    }
+
+    bool valid = true;
+    for (int i = 0; i < ir->count && valid; i++) {
+        ir_instruction_t* instruction = &ir->code[i];
+        if (instruction->removed || !_is_jump(instruction->op))
+            continue;
+
+        int after = offsets[i] + 3;
+        int target = offsets[instruction->target];
+        int jump = instruction->op == OP_LOOP ? after - target : target - after;
+        valid = jump >= 0 && jump <= UINT16_MAX;
+    }
+
+    if (valid) {
+        chunk_t lowered;
+        l_init_chunk(&lowered);
+
+        for (int i = 0; i < ir->count; i++) {
+            ir_instruction_t* instruction = &ir->code[i];
+            if (instruction->removed)
+                continue;
+
+            l_write_chunk(&lowered, instruction->op, instruction->line);
+            if (_is_jump(instruction->op)) {
+                int after = offsets[i] + 3;
+                int target = offsets[instruction->target];
+                int jump = instruction->op == OP_LOOP ? after - target : target - after;
+                l_write_chunk(&lowered, (jump >> 8) & 0xff, instruction->line);
+                l_write_chunk(&lowered, jump & 0xff, instruction->line);
+            } else {
+                for (int b = 0; b < instruction->length - 1; b++) {
+                    l_write_chunk(&lowered, instruction->operands[b], instruction->line);
+                }
+            }
+        }
+
+        FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+        FREE_ARRAY(line_start_t, chunk->lines, chunk->line_capacity);
+        chunk->code = lowered.code;
+        chunk->lines = lowered.lines;
+        chunk->count = lowered.count;
+        chunk->capacity = lowered.capacity;
+        chunk->line_count = lowered.line_count;
+        chunk->line_capacity = lowered.line_capacity;
+    }
+
+    FREE_ARRAY(int, offsets, ir->count);
+    return valid;
+}
+
+void l_optimize_function(obj_function_t* function) {
+    if (_optimize_level == 0 || function->chunk.count == 0)
+        return;
+
+    TIMELINE_BEGIN(TIMELINE_COMPILE, "optimize");
+    int capacity = function->chunk.count;
+    ir_function_t ir;
+    if (_lift(&ir, function)) {
+        for (int round = 0; round < MAX_PASS_ROUNDS; round++) {
+            bool changed = false;
+            for (int p = 0; p < (int)(sizeof(_passes) / sizeof(_passes[0])); p++) {
+                if (_passes[p].level > _optimize_level)
+                    continue;
+
+                _resolve_targets(&ir);
+                changed |= _passes[p].run(&ir);
+            }
+
+            if (!changed)
+                break;
+        }
+
+        _resolve_targets(&ir);
+        _lower(&ir, &function->chunk);
+    }
+
+    FREE_ARRAY(ir_instruction_t, ir.code, capacity);
+    TIMELINE_END(TIMELINE_COMPILE);
+}
@@ -0,0 +1,19 @@
+#ifndef LOX_OPTIMIZER_H
+#define LOX_OPTIMIZER_H
+
+#include "common.h"
+#include "object.h"
+
+// 1: jump threading and dead code elimination
+// 2: constant propagation
+// 3: register addressed arithmetic
+#define OPTIMIZE_LEVEL_MAX 3
+
+void l_set_optimize_level(int level);
+int  l_get_optimize_level();
+
+// Lifts the function's bytecode into an instruction list, runs the passes
+// enabled at the current level over it and re-emits the chunk.
+void l_optimize_function(obj_function_t* function);
+
+#endif
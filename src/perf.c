@@ -0,0 +1,327 @@
+#include "perf.h"
+
+#ifdef LOX_PERF
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "vm.h"
+#include "lib/counters.h"
+
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_CACHE_MISSES,
+    PERF_TASK_CLOCK,     // software, always available and drives the sampling
+    PERF_COUNTER_COUNT,
+} PerfCounter;
+
+static const struct {
+    const char* name;
+    uint32_t    type;
+    uint64_t    config;
+} _counters[PERF_COUNTER_COUNT] = {
+    [PERF_CYCLES]        = { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS]  = { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_BRANCH_MISSES] = { "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_CACHE_MISSES]  = { "cache-misses",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_TASK_CLOCK]    = { "task-clock",    PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+typedef struct {
+    uint64_t values[PERF_COUNTER_COUNT];
+} perf_counts_t;
+
+// Like the profiler's samples, everything is kept in malloc'd memory so
+// reading the counters never allocates from, or triggers, the GC. Each
+// function's counter carries the perf_counts_t attributed to it.
+typedef struct {
+    int              fds[PERF_COUNTER_COUNT];  // -1 for counters that couldn't be opened
+    perf_counts_t    last;                     // values at the last read attributed
+    perf_counts_t    run_start;
+    perf_counts_t    gc_start;
+    bool             in_run;
+
+    perf_counts_t*   runs;
+    int              run_count;
+    int              run_capacity;
+
+    perf_counts_t    gc;
+    int              gc_count;
+
+    counter_table_t  functions;
+
+    struct sigaction previous;
+} perf_t;
+
+static perf_t _perf;
+static bool   _running = false;
+
+static void _on_sample(int signal) {
+    (void)signal;
+    vm.perf_sample_pending = 1;
+    vm.event_pending = 1;
+}
+
+static int _open(PerfCounter counter, uint64_t period) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = _counters[counter].type;
+    attr.config = _counters[counter].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // counters the PMU multiplexes are scaled by the time they ran
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (period > 0) {
+        attr.sample_period = period;
+        attr.wakeup_events = 1;
+    }
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void _read(perf_counts_t* counts) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        uint64_t data[3]; // value, time enabled, time running
+        counts->values[i] = 0;
+        if (_perf.fds[i] == -1 || read(_perf.fds[i], data, sizeof(data)) != sizeof(data))
+            continue;
+        counts->values[i] = data[2] == 0 || data[2] == data[1]
+                          ? data[0]
+                          : (uint64_t)((double)data[0] * data[1] / data[2]);
+    }
+}
+
+static void _add_difference(perf_counts_t* total, perf_counts_t* to, perf_counts_t* from) {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        total->values[i] += to->values[i] - from->values[i];
+    }
+}
+
+// the counts since the last read go to the function on top of the call stack
+static void _attribute(perf_counts_t* now) {
+    if (!_perf.in_run || vm.frame_count == 0)
+        return;
+
+    obj_function_t* running = vm.frames[vm.frame_count - 1].closure->function;
+    char name[128];
+    int length = snprintf(name, sizeof(name), "%s:%d",
+                          running->name == NULL ? "script" : running->name->chars,
+                          l_get_line(&running->chunk, 0));
+    if (length < 0)
+        return;
+    if (length >= (int)sizeof(name))
+        length = sizeof(name) - 1;
+
+    counter_t* function = l_count_key(&_perf.functions, name, length);
+    if (function != NULL)
+        _add_difference(function->data, now, &_perf.last);
+}
+
+void l_perf_sample() {
+    vm.perf_sample_pending = 0;
+    if (!_running)
+        return;
+
+    perf_counts_t now;
+    _read(&now);
+    _attribute(&now);
+    _perf.last = now;
+}
+
+void l_perf_run_begin() {
+    if (!_running)
+        return;
+
+    _read(&_perf.run_start);
+    _perf.last = _perf.run_start;
+    _perf.in_run = true;
+}
+
+void l_perf_run_end() {
+    if (!_running || !_perf.in_run)
+        return;
+
+    perf_counts_t now;
+    _read(&now);
+    _perf.in_run = false;
+
+    if (_perf.run_count == _perf.run_capacity) {
+        int capacity = _perf.run_capacity < 8 ? 8 : _perf.run_capacity * 2;
+        perf_counts_t* runs = realloc(_perf.runs, sizeof(perf_counts_t) * capacity);
+        if (runs == NULL)
+            return;
+        _perf.runs = runs;
+        _perf.run_capacity = capacity;
+    }
+    perf_counts_t* run = &_perf.runs[_perf.run_count++];
+    memset(run, 0, sizeof(perf_counts_t));
+    _add_difference(run, &now, &_perf.run_start);
+}
+
+void l_perf_gc_begin() {
+    if (!_running)
+        return;
+
+    // what ran up to the collection is attributed so the collection itself
+    // isn't charged to the function that triggered it
+    _read(&_perf.gc_start);
+    _attribute(&_perf.gc_start);
+    _perf.last = _perf.gc_start;
+}
+
+void l_perf_gc_end() {
+    if (!_running)
+        return;
+
+    _read(&_perf.last);
+    _add_difference(&_perf.gc, &_perf.last, &_perf.gc_start);
+    _perf.gc_count++;
+}
+
+static void _close() {
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (_perf.fds[i] != -1)
+            close(_perf.fds[i]);
+        _perf.fds[i] = -1;
+    }
+}
+
+bool l_start_perf() {
+    if (_running)
+        return false;
+
+    memset(&_perf, 0, sizeof(_perf));
+    l_init_counter_table(&_perf.functions, sizeof(perf_counts_t));
+
+    int hardware = 0;
+    int error = 0;
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        _perf.fds[i] = _open(i, i == PERF_TASK_CLOCK ? PERF_READ_INTERVAL : 0);
+        if (_perf.fds[i] == -1 && error == 0)
+            error = errno;
+        if (_perf.fds[i] != -1 && _counters[i].type == PERF_TYPE_HARDWARE)
+            hardware++;
+    }
+
+    if (hardware == 0) {
+        fprintf(stderr, "Hardware performance counters are not available: %s.\n",
+                strerror(error));
+        _close();
+        return false;
+    }
+
+    // the task clock signals every sample period of CPU time
+    int clock = _perf.fds[PERF_TASK_CLOCK];
+    if (clock != -1) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = _on_sample;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGIO, &action, &_perf.previous) != 0 ||
+            fcntl(clock, F_SETFL, O_ASYNC) == -1 ||
+            fcntl(clock, F_SETOWN, getpid()) == -1) {
+            fprintf(stderr, "Functions won't be sampled: %s.\n", strerror(errno));
+            sigaction(SIGIO, &_perf.previous, NULL);
+            close(clock);
+            _perf.fds[PERF_TASK_CLOCK] = -1;
+        }
+    }
+
+    _read(&_perf.last);
+    _running = true;
+    return true;
+}
+
+static void _write_header(FILE* file, const char* label) {
+    fprintf(file, "%-28s", label);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (_perf.fds[i] == -1)
+            continue;
+        fprintf(file, " %15s", i == PERF_TASK_CLOCK ? "task ms" : _counters[i].name);
+        if (i == PERF_INSTRUCTIONS && _perf.fds[PERF_CYCLES] != -1)
+            fprintf(file, " %6s", "IPC");
+    }
+    fputc('\n', file);
+}
+
+static void _write_counts(FILE* file, const char* label, perf_counts_t* counts) {
+    fprintf(file, "%-28s", label);
+    for (int i = 0; i < PERF_COUNTER_COUNT; i++) {
+        if (_perf.fds[i] == -1)
+            continue;
+        if (i == PERF_TASK_CLOCK) {
+            fprintf(file, " %15.2f", counts->values[i] / 1000000.0);
+        } else {
+            fprintf(file, " %15llu", (unsigned long long)counts->values[i]);
+        }
+        if (i == PERF_INSTRUCTIONS && _perf.fds[PERF_CYCLES] != -1) {
+            uint64_t cycles = counts->values[PERF_CYCLES];
+            fprintf(file, " %6.2f", cycles == 0 ? 0.0 : (double)counts->values[i] / cycles);
+        }
+    }
+    fputc('\n', file);
+}
+
+static PerfCounter _sort_counter;
+
+static int _compare_functions(const void* a, const void* b) {
+    uint64_t left = ((perf_counts_t*)(*(counter_t* const*)a)->data)->values[_sort_counter];
+    uint64_t right = ((perf_counts_t*)(*(counter_t* const*)b)->data)->values[_sort_counter];
+    return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void l_stop_perf(FILE* file) {
+    if (!_running)
+        return;
+
+    if (_perf.fds[PERF_TASK_CLOCK] != -1)
+        sigaction(SIGIO, &_perf.previous, NULL);
+    _running = false;
+    vm.perf_sample_pending = 0;
+
+    char label[64];
+    _write_header(file, "perf counters");
+    for (int i = 0; i < _perf.run_count; i++) {
+        snprintf(label, sizeof(label), "run %d", i + 1);
+        _write_counts(file, label, &_perf.runs[i]);
+    }
+    snprintf(label, sizeof(label), "gc (%d collections)", _perf.gc_count);
+    _write_counts(file, label, &_perf.gc);
+
+    counter_table_t* table = &_perf.functions;
+    if (table->count > 0) {
+        counter_t** functions = malloc(sizeof(counter_t*) * table->count);
+        if (functions != NULL) {
+            int count = 0;
+            for (int i = l_counter_table_next(table, -1); i != -1; i = l_counter_table_next(table, i)) {
+                functions[count++] = &table->entries[i];
+            }
+            _sort_counter = _perf.fds[PERF_CYCLES] != -1 ? PERF_CYCLES : PERF_TASK_CLOCK;
+            qsort(functions, count, sizeof(counter_t*), _compare_functions);
+
+            fprintf(file, "functions, sampled every %.1fms of CPU time\n",
+                    PERF_READ_INTERVAL / 1000000.0);
+            for (int i = 0; i < count; i++) {
+                _write_counts(file, functions[i]->key, functions[i]->data);
+            }
+            free(functions);
+        }
+    }
+
+    _close();
+    l_free_counter_table(&_perf.functions);
+    free(_perf.runs);
+    memset(&_perf, 0, sizeof(_perf));
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef LOX_PERF_H
+#define LOX_PERF_H
+
+#include "common.h"
+
+#ifdef LOX_PERF
+
+// nanoseconds of CPU time between the reads attributing counts to functions
+#define PERF_READ_INTERVAL 1000000
+
+// Opens perf_event counters for cycles, instructions, branch misses and
+// cache misses on this process, counting user space only. Returns false,
+// after saying why on stderr, when none of the hardware counters can be
+// opened, as in most virtual machines and containers. Counters the CPU
+// doesn't have are left out of the report.
+bool l_start_perf();
+
+// Closes the counters and writes the counts for each run, for the garbage
+// collector and for each function to file.
+void l_stop_perf(FILE* file);
+
+// Called by the VM around each script run and each collection. A run's
+// counts include its collections, which are also totalled on their own.
+void l_perf_run_begin();
+void l_perf_run_end();
+void l_perf_gc_begin();
+void l_perf_gc_end();
+
+// Every PERF_READ_INTERVAL of CPU time a signal flags a sample and the
+// interpreter calls this at the next back edge, call or return. The counts since the last
+// sample are attributed to the function running, named by its name and
+// the line of its first instruction.
+void l_perf_sample();
+
+#endif
+
+#endif
@@ -0,0 +1,122 @@
+#include "profiler.h"
+
+#ifdef LOX_PROFILER
+
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "chunk.h"
+#include "vm.h"
+#include "lib/counters.h"
+
+// longest collapsed stack recorded, deeper stacks are cut at the caller end
+#define PROFILE_STACK_MAX 4096
+
+// Samples are aggregated by stack as they are taken, in a counter table
+// so profiling doesn't allocate from, or trigger, the GC.
+typedef struct {
+    const char*      path;
+    counter_table_t  stacks;
+    int              samples;
+    struct sigaction previous;
+} profiler_t;
+
+static profiler_t _profiler;
+static bool       _running = false;
+
+static void _on_timer(int signal) {
+    (void)signal;
+    vm.sample_pending = 1;
+    vm.event_pending = 1;
+}
+
+void l_profile_sample() {
+    vm.sample_pending = 0;
+    if (!_running || vm.frame_count == 0)
+        return;
+
+    char stack[PROFILE_STACK_MAX];
+    int length = 0;
+
+    // root first, each frame as name:line
+    for (int i = 0; i < vm.frame_count; i++) {
+        callframe_t* frame = &vm.frames[i];
+        obj_function_t* function = frame->closure->function;
+
+        // callers have moved past their call instruction, the sampled frame
+        // is about to execute the one at ip
+        int offset = (int)(frame->ip - function->chunk.code);
+        if (i < vm.frame_count - 1)
+            offset--;
+
+        int written = snprintf(stack + length, sizeof(stack) - length, "%s%s:%d",
+                               i == 0 ? "" : ";",
+                               function->name == NULL ? "script" : function->name->chars,
+                               l_get_line(&function->chunk, offset));
+        if (written < 0 || written >= (int)sizeof(stack) - length)
+            break;
+        length += written;
+    }
+
+    if (l_count_key(&_profiler.stacks, stack, length) != NULL)
+        _profiler.samples++;
+}
+
+bool l_start_profiler(const char* path) {
+    if (_running)
+        return false;
+
+    memset(&_profiler, 0, sizeof(_profiler));
+    l_init_counter_table(&_profiler.stacks, 0);
+    _profiler.path = path;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = _on_timer;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &_profiler.previous) != 0)
+        return false;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / PROFILE_FREQUENCY;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &_profiler.previous, NULL);
+        return false;
+    }
+
+    _running = true;
+    return true;
+}
+
+void l_stop_profiler() {
+    if (!_running)
+        return;
+
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &_profiler.previous, NULL);
+    _running = false;
+    vm.sample_pending = 0;
+
+    FILE* file = fopen(_profiler.path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", _profiler.path);
+    } else {
+        counter_table_t* stacks = &_profiler.stacks;
+        for (int i = l_counter_table_next(stacks, -1); i != -1; i = l_counter_table_next(stacks, i)) {
+            fprintf(file, "%s %d\n", stacks->entries[i].key, stacks->entries[i].count);
+        }
+        fclose(file);
+    }
+
+    l_free_counter_table(&_profiler.stacks);
+    memset(&_profiler, 0, sizeof(_profiler));
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef LOX_PROFILER_H
+#define LOX_PROFILER_H
+
+#include "common.h"
+
+#ifdef LOX_PROFILER
+
+// samples per second of CPU time
+#define PROFILE_FREQUENCY 1000
+
+// Starts sampling the call stack on a CPU time interval timer. The timer
+// only flags that a sample is due, the interpreter takes it at the next
+// back edge, call or return so the frames it walks are consistent. Native code from
+// the JIT is sampled when it returns to the interpreter.
+bool l_start_profiler(const char* path);
+
+// Stops the timer and writes the samples to the path given to
+// l_start_profiler as collapsed stacks, one "script:3;outer:12;inner:4 N"
+// line per distinct stack, which flamegraph.pl and speedscope read.
+void l_stop_profiler();
+
+// records the current vm.frames call stack, called by the VM
+void l_profile_sample();
+
+#endif
+
+#endif
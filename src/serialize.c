@@ -0,0 +1,629 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LOX_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "inliner.h"
+#include "serialize.h"
+#include "vm.h"
+#include "lib/memory.h"
+
+typedef enum {
+    CONSTANT_NIL,
+    CONSTANT_FALSE,
+    CONSTANT_TRUE,
+    CONSTANT_NUMBER,
+    CONSTANT_STRING,
+    CONSTANT_FUNCTION,
+} ConstantTag;
+
+#define NO_NAME UINT32_MAX
+
+// alignment of the line tables
+#define IMAGE_ALIGNMENT 4
+
+typedef struct bytecode_image_t {
+    void*                    data;
+    size_t                   size;
+    struct bytecode_image_t* next;
+} bytecode_image_t;
+
+static bytecode_image_t* _images = NULL;
+
+// Writing
+
+typedef struct {
+    uint8_t* data;
+    size_t   count;
+    size_t   capacity;
+    bool     failed;
+} writer_t;
+
+static void _write_bytes(writer_t* w, const void* bytes, size_t length) {
+    if (w->failed)
+        return;
+
+    if (w->capacity < w->count + length) {
+        size_t capacity = w->capacity < 256 ? 256 : w->capacity;
+        while (capacity < w->count + length) {
+            capacity *= 2;
+        }
+        uint8_t* data = realloc(w->data, capacity);
+        if (data == NULL) {
+            w->failed = true;
+            return;
+        }
+        w->data = data;
+        w->capacity = capacity;
+    }
+    memcpy(w->data + w->count, bytes, length);
+    w->count += length;
+}
+
+static void _write_u8(writer_t* w, uint8_t value) {
+    _write_bytes(w, &value, 1);
+}
+
+static void _write_u32(writer_t* w, uint32_t value) {
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = (value >> (i * 8)) & 0xff;
+    }
+    _write_bytes(w, bytes, sizeof(bytes));
+}
+
+static void _write_u64(writer_t* w, uint64_t value) {
+    uint8_t bytes[8];
+    for (int i = 0; i < 8; i++) {
+        bytes[i] = (value >> (i * 8)) & 0xff;
+    }
+    _write_bytes(w, bytes, sizeof(bytes));
+}
+
+static void _write_align(writer_t* w) {
+    static const uint8_t padding[IMAGE_ALIGNMENT] = {0};
+    size_t remainder = w->count % IMAGE_ALIGNMENT;
+    if (remainder != 0) {
+        _write_bytes(w, padding, IMAGE_ALIGNMENT - remainder);
+    }
+}
+
+static void _write_string(writer_t* w, obj_string_t* string) {
+    _write_u32(w, (uint32_t)string->length);
+    _write_u32(w, string->hash);
+    // chars and the NUL terminator, so the string can be used in place
+    _write_bytes(w, string->chars, string->length + 1);
+}
+
+static void _write_function(writer_t* w, obj_function_t* function);
+
+static void _write_constant(writer_t* w, value_t value) {
+    if (IS_NIL(value)) {
+        _write_u8(w, CONSTANT_NIL);
+    } else if (IS_BOOL(value)) {
+        _write_u8(w, AS_BOOL(value) ? CONSTANT_TRUE : CONSTANT_FALSE);
+    } else if (IS_NUMBER(value)) {
+        uint64_t bits;
+        double number = AS_NUMBER(value);
+        memcpy(&bits, &number, sizeof(bits));
+        _write_u8(w, CONSTANT_NUMBER);
+        _write_u64(w, bits);
+    } else if (IS_STRING(value)) {
+        _write_u8(w, CONSTANT_STRING);
+        _write_string(w, AS_STRING(value));
+    } else if (IS_FUNCTION(value)) {
+        _write_u8(w, CONSTANT_FUNCTION);
+        _write_function(w, AS_FUNCTION(value));
+    } else {
+        // the compiler never emits other objects as constants
+        w->failed = true;
+    }
+}
+
+static void _write_function(writer_t* w, obj_function_t* function) {
+    chunk_t* chunk = &function->chunk;
+
+    _write_u32(w, (uint32_t)function->arity);
+    _write_u32(w, (uint32_t)function->upvalue_count);
+    if (function->name == NULL) {
+        _write_u32(w, NO_NAME);
+    } else {
+        _write_string(w, function->name);
+    }
+
+    _write_u8(w, function->inline_kind);
+    _write_u8(w, function->inline_op);
+    _write_u8(w, function->inline_a);
+    _write_u8(w, function->inline_b);
+
+    _write_u32(w, (uint32_t)chunk->count);
+    _write_bytes(w, chunk->code, chunk->count);
+    _write_align(w);
+    _write_u32(w, (uint32_t)chunk->line_count);
+    for (int i = 0; i < chunk->line_count; i++) {
+        _write_u32(w, (uint32_t)chunk->lines[i].offset);
+        _write_u32(w, (uint32_t)chunk->lines[i].line);
+    }
+
+    _write_u32(w, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        _write_constant(w, chunk->constants.values[i]);
+    }
+}
+
+bool l_serialize_function(obj_function_t* function, uint8_t** data, size_t* size) {
+    writer_t w = {0};
+
+    _write_bytes(&w, BYTECODE_MAGIC, strlen(BYTECODE_MAGIC));
+    _write_u32(&w, BYTECODE_VERSION);
+    _write_function(&w, function);
+
+    if (w.failed) {
+        free(w.data);
+        return false;
+    }
+
+    *data = w.data;
+    *size = w.count;
+    return true;
+}
+
+// Reading
+
+typedef struct {
+    const uint8_t* data;
+    size_t         size;
+    size_t         position;
+    bool           failed;
+    bool           in_place; // point into data rather than copying from it
+} reader_t;
+
+static const uint8_t* _read_bytes(reader_t* r, size_t length) {
+    if (r->failed || r->size - r->position < length) {
+        r->failed = true;
+        return NULL;
+    }
+    const uint8_t* bytes = r->data + r->position;
+    r->position += length;
+    return bytes;
+}
+
+static void _read_align(reader_t* r) {
+    size_t remainder = r->position % IMAGE_ALIGNMENT;
+    if (remainder != 0) {
+        _read_bytes(r, IMAGE_ALIGNMENT - remainder);
+    }
+}
+
+static uint8_t _read_u8(reader_t* r) {
+    const uint8_t* bytes = _read_bytes(r, 1);
+    return bytes == NULL ? 0 : bytes[0];
+}
+
+static uint32_t _decode_u32(const uint8_t* bytes) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        value |= (uint32_t)bytes[i] << (i * 8);
+    }
+    return value;
+}
+
+static uint32_t _read_u32(reader_t* r) {
+    const uint8_t* bytes = _read_bytes(r, 4);
+    return bytes == NULL ? 0 : _decode_u32(bytes);
+}
+
+static uint64_t _read_u64(reader_t* r) {
+    const uint8_t* bytes = _read_bytes(r, 8);
+    if (bytes == NULL)
+        return 0;
+
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)bytes[i] << (i * 8);
+    }
+    return value;
+}
+
+// constants are interned like the compiler's so identity comparisons, such
+// as global lookups, still hold. The stored hash has to be the hash of the
+// characters, a mapped string is interned under it.
+static obj_string_t* _read_string(reader_t* r, uint32_t length) {
+    uint32_t hash = _read_u32(r);
+    const char* chars = length < INT32_MAX ? (const char*)_read_bytes(r, length + 1) : NULL;
+    if (chars == NULL || chars[length] != '\0') {
+        r->failed = true;
+        return NULL;
+    }
+
+    obj_string_t* string = r->in_place ? l_mapped_string(chars, (int)length, hash)
+                                       : l_copy_interned_string(chars, (int)length);
+    if (string == NULL || string->hash != hash) {
+        r->failed = true;
+        return NULL;
+    }
+    return string;
+}
+
+static obj_function_t* _read_function(reader_t* r);
+
+static bool _read_constant(reader_t* r, chunk_t* chunk) {
+    // new objects are reachable through the chunk once added, and
+    // l_add_constant keeps them on the stack while it grows the array
+    switch (_read_u8(r)) {
+        case CONSTANT_NIL:
+            l_add_constant(chunk, NIL_VAL);
+            return true;
+        case CONSTANT_FALSE:
+            l_add_constant(chunk, BOOL_VAL(false));
+            return true;
+        case CONSTANT_TRUE:
+            l_add_constant(chunk, BOOL_VAL(true));
+            return true;
+        case CONSTANT_NUMBER: {
+            uint64_t bits = _read_u64(r);
+            double number;
+            memcpy(&number, &bits, sizeof(number));
+            l_add_constant(chunk, NUMBER_VAL(number));
+            return !r->failed;
+        }
+        case CONSTANT_STRING: {
+            obj_string_t* string = _read_string(r, _read_u32(r));
+            if (string == NULL)
+                return false;
+            l_add_constant(chunk, OBJ_VAL(string));
+            return true;
+        }
+        case CONSTANT_FUNCTION: {
+            obj_function_t* function = _read_function(r);
+            if (function == NULL)
+                return false;
+            l_add_constant(chunk, OBJ_VAL(function));
+            l_pop();
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+static bool _is_constant(chunk_t* chunk, uint8_t index) {
+    return index < chunk->constants.count;
+}
+
+static bool _is_name(chunk_t* chunk, uint8_t index) {
+    return _is_constant(chunk, index) && IS_STRING(chunk->constants.values[index]);
+}
+
+static bool _is_binary_op(uint8_t op) {
+    return op >= OP_EQUAL && op <= OP_DIVIDE;
+}
+
+// Checks the operands the VM and the JIT use without checking: constant
+// indices and their types, upvalue indices and jump targets, which must
+// land on an instruction. The code has to end in a return.
+static bool _validate_code(obj_function_t* function) {
+    chunk_t* chunk = &function->chunk;
+    const uint8_t* code = chunk->code;
+    int count = chunk->count;
+    if (count == 0)
+        return false;
+
+    // instruction starts, and the offsets jumped to
+    uint8_t* marks = calloc(count, sizeof(uint8_t));
+    if (marks == NULL)
+        return false;
+    enum { MARK_START = 1, MARK_TARGET = 2 };
+
+    bool valid = true;
+    int offset = 0;
+    int last = 0;
+    while (valid && offset < count) {
+        uint8_t op = code[offset];
+        // OP_CLOSURE's length comes from its function, which is checked first
+        if (op == OP_CLOSURE &&
+            !(offset + 1 < count && _is_constant(chunk, code[offset + 1]) &&
+              IS_FUNCTION(chunk->constants.values[code[offset + 1]]))) {
+            valid = false;
+            break;
+        }
+        int length = op < OP_COVERAGE ? l_instruction_length(chunk, offset) : 0;
+        if (length == 0 || length > count - offset) {
+            valid = false;
+            break;
+        }
+
+        const uint8_t* operands = code + offset + 1;
+        switch (op) {
+            case OP_CONSTANT:
+                valid = _is_constant(chunk, operands[0]);
+                break;
+            case OP_GET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_GET_SUPER:
+            case OP_CLASS:
+            case OP_METHOD:
+            case OP_INVOKE:
+            case OP_TAIL_INVOKE:
+            case OP_SUPER_INVOKE:
+                valid = _is_name(chunk, operands[0]);
+                break;
+            case OP_GET_UPVALUE:
+            case OP_SET_UPVALUE:
+                valid = operands[0] < function->upvalue_count;
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_LOOP: {
+                int jump = (operands[0] << 8) | operands[1];
+                int target = op == OP_LOOP ? offset + 3 - jump : offset + 3 + jump;
+                valid = target >= 0 && target < count;
+                if (valid)
+                    marks[target] |= MARK_TARGET;
+                break;
+            }
+            case OP_BINARY_LL:
+            case OP_STORE_BINARY_LL:
+                valid = _is_binary_op(operands[0]);
+                break;
+            case OP_BINARY_LK:
+                valid = _is_binary_op(operands[0]) && _is_constant(chunk, operands[2]);
+                break;
+            case OP_STORE_BINARY_LK:
+                valid = _is_binary_op(operands[0]) && _is_constant(chunk, operands[3]);
+                break;
+            case OP_CLOSURE:
+                // pairs of is local and index, captured upvalues index ours
+                for (int i = 1; i < length - 1 && valid; i += 2) {
+                    valid = operands[i] <= 1 &&
+                            (operands[i] == 1 || operands[i + 1] < function->upvalue_count);
+                }
+                break;
+            default:
+                break;
+        }
+
+        marks[offset] |= MARK_START;
+        last = offset;
+        offset += length;
+    }
+
+    valid = valid && code[last] == OP_RETURN;
+    for (int i = 0; i < count && valid; i++) {
+        if ((marks[i] & MARK_TARGET) && !(marks[i] & MARK_START))
+            valid = false;
+    }
+    free(marks);
+    return valid;
+}
+
+// The inline classification is trusted by the VM's call path, so it has to
+// be the one the inliner derives from the code.
+static bool _validate_inline(obj_function_t* function) {
+    if (function->inline_kind == INLINE_NONE)
+        return true;
+
+    InlineKind kind = function->inline_kind;
+    uint8_t op = function->inline_op;
+    uint8_t a = function->inline_a;
+    uint8_t b = function->inline_b;
+    l_analyze_inline(function);
+    return function->inline_kind == kind && function->inline_op == op &&
+           function->inline_a == a && function->inline_b == b;
+}
+
+// On success the function is left on the stack for the caller to pop once
+// it's reachable from elsewhere.
+static obj_function_t* _read_function(reader_t* r) {
+    obj_function_t* function = l_new_function();
+    l_push(OBJ_VAL(function));
+
+    function->arity = (int)_read_u32(r);
+    function->upvalue_count = (int)_read_u32(r);
+
+    uint32_t nameLength = _read_u32(r);
+    if (nameLength != NO_NAME) {
+        function->name = _read_string(r, nameLength);
+    }
+
+    function->inline_kind = (InlineKind)_read_u8(r);
+    function->inline_op = _read_u8(r);
+    function->inline_a = _read_u8(r);
+    function->inline_b = _read_u8(r);
+
+    uint32_t count = _read_u32(r);
+    const uint8_t* code = count <= INT32_MAX ? _read_bytes(r, count) : NULL;
+    _read_align(r);
+    uint32_t lineCount = _read_u32(r);
+    const uint8_t* lineData = lineCount <= INT32_MAX / sizeof(line_start_t)
+                            ? _read_bytes(r, (size_t)lineCount * sizeof(line_start_t))
+                            : NULL;
+    if (code == NULL || lineData == NULL) {
+        l_pop();
+        return NULL;
+    }
+
+    chunk_t* chunk = &function->chunk;
+    chunk->count = (int)count;
+    chunk->line_count = (int)lineCount;
+    if (r->in_place) {
+        // the image is only mapped on little endian hosts, where the line
+        // table already has the layout of a line_start_t array
+        chunk->code = (uint8_t*)code;
+        chunk->lines = (line_start_t*)lineData;
+        chunk->mapped = true;
+    } else {
+        uint8_t* chunkCode = ALLOCATE(uint8_t, count);
+        line_start_t* lines = ALLOCATE(line_start_t, lineCount);
+        memcpy(chunkCode, code, count);
+        for (uint32_t i = 0; i < lineCount; i++) {
+            lines[i].offset = (int)_decode_u32(lineData + i * 8);
+            lines[i].line = (int)_decode_u32(lineData + i * 8 + 4);
+        }
+        chunk->code = chunkCode;
+        chunk->lines = lines;
+        chunk->capacity = (int)count;
+        chunk->line_capacity = (int)lineCount;
+    }
+
+    uint32_t constantCount = _read_u32(r);
+    for (uint32_t i = 0; i < constantCount && !r->failed; i++) {
+        if (!_read_constant(r, chunk)) {
+            r->failed = true;
+        }
+    }
+
+    if (r->failed || function->upvalue_count < 0 || function->upvalue_count > UINT8_COUNT ||
+        !_validate_code(function) || !_validate_inline(function)) {
+        l_pop();
+        return NULL;
+    }
+    return function;
+}
+
+bool l_is_bytecode(const uint8_t* data, size_t size) {
+    size_t length = strlen(BYTECODE_MAGIC);
+    return size >= length && memcmp(data, BYTECODE_MAGIC, length) == 0;
+}
+
+static obj_function_t* _load(const uint8_t* data, size_t size, bool inPlace) {
+    if (!l_is_bytecode(data, size)) {
+        fprintf(stderr, "Not a lox bytecode file.\n");
+        return NULL;
+    }
+
+    reader_t r = {
+        .data = data,
+        .size = size,
+        .position = strlen(BYTECODE_MAGIC),
+        .failed = false,
+        .in_place = inPlace,
+    };
+
+    uint32_t version = _read_u32(&r);
+    if (!r.failed && version != BYTECODE_VERSION) {
+        fprintf(stderr, "Bytecode version %u is not supported, expected %d. Recompile the script.\n",
+                version, BYTECODE_VERSION);
+        return NULL;
+    }
+
+    obj_function_t* function = r.failed ? NULL : _read_function(&r);
+    // the script is called without arguments, in a closure without upvalues
+    if (function != NULL && (function->arity != 0 || function->upvalue_count != 0)) {
+        l_pop();
+        function = NULL;
+    }
+    if (function == NULL) {
+        fprintf(stderr, "Bytecode file is truncated or corrupt.\n");
+        return NULL;
+    }
+    l_pop();
+
+    return function;
+}
+
+obj_function_t* l_deserialize_function(const uint8_t* data, size_t size) {
+    return _load(data, size, false);
+}
+
+static bool _little_endian() {
+    const uint32_t value = 1;
+    return *(const uint8_t*)&value == 1;
+}
+
+static void _release_image(void* data, size_t size) {
+#ifdef LOX_WINDOWS
+    (void)size;
+    free(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Maps the file read-only, or reads it into memory where mmap isn't
+// available. Returns NULL with the problem reported on failure.
+static void* _map_file(const char* path, size_t* size) {
+#ifdef LOX_WINDOWS
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+
+    void* data = malloc(*size);
+    if (data == NULL || fread(data, 1, *size, file) < *size) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return NULL;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t)info.st_size;
+    void* data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Could not map file \"%s\".\n", path);
+        return NULL;
+    }
+    return data;
+#endif
+}
+
+obj_function_t* l_load_bytecode_file(const char* path) {
+    _Static_assert(sizeof(line_start_t) == 8, "mapped line tables are pairs of 32 bit integers");
+
+    size_t size;
+    void* data = _map_file(path, &size);
+    if (data == NULL)
+        return NULL;
+
+    // functions and strings loaded in place refer to the image for as long
+    // as the VM lives, even when loading fails part way through
+    bytecode_image_t* image = malloc(sizeof(bytecode_image_t));
+    if (image == NULL) {
+        _release_image(data, size);
+        return NULL;
+    }
+    image->data = data;
+    image->size = size;
+    image->next = _images;
+    _images = image;
+
+    return _load(data, size, _little_endian());
+}
+
+void l_free_bytecode_images() {
+    while (_images != NULL) {
+        bytecode_image_t* next = _images->next;
+        _release_image(_images->data, _images->size);
+        free(_images);
+        _images = next;
+    }
+}
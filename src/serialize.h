@@ -0,0 +1,47 @@
+#ifndef LOX_SERIALIZE_H
+#define LOX_SERIALIZE_H
+
+#include "common.h"
+#include "object.h"
+
+// Precompiled bytecode (.loxc)
+//
+// A header of the magic bytes and the format version, followed by the
+// script function. A function is written as its arity, upvalue count,
+// name, inline classification, code, lines and constants, with nested
+// functions written in place as constants. Upvalue descriptors are the
+// operands of OP_CLOSURE and travel with the code. Integers are little
+// endian and numbers are their IEEE 754 bits.
+//
+// The layout can be executed in place: line tables are 4 byte aligned
+// arrays of line_start_t and strings carry their hash and a NUL terminator, so a
+// mapped image only needs its objects allocated, code, lines and string
+// characters are used straight from the mapping.
+#define BYTECODE_MAGIC     "LOXC"
+#define BYTECODE_EXTENSION ".loxc"
+
+// bump whenever the encoding or the instruction set changes
+#define BYTECODE_VERSION 3
+
+// Serializes the function into a malloc'd buffer owned by the caller.
+// Returns false if a constant can't be represented.
+bool l_serialize_function(obj_function_t* function, uint8_t** data, size_t* size);
+
+// Rebuilds the function written by l_serialize_function, reporting the
+// problem and returning NULL if the data is malformed or from another
+// version. Constant and upvalue indices, jump targets, string hashes and
+// the inline classification are checked against the function, the stack
+// depth and local slots the code uses aren't, so images should come from
+// --compile.
+obj_function_t* l_deserialize_function(const uint8_t* data, size_t size);
+
+bool l_is_bytecode(const uint8_t* data, size_t size);
+
+// Maps the .loxc file read-only and loads it in place, the mapping is
+// shared with other processes running the same file through the page
+// cache and stays alive until l_free_bytecode_images.
+obj_function_t* l_load_bytecode_file(const char* path);
+// unmaps every loaded image, called when the VM is freed
+void l_free_bytecode_images();
+
+#endif
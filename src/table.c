@@ -6,8 +6,6 @@
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
-
 void l_init_table(table_t* table) {
     table->count = 0;
     table->capacity = 0;
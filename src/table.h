@@ -4,6 +4,10 @@
 #include "common.h"
 #include "value.h"
 
+// a set that would take the table over this load grows it first, even
+// when the key is already there
+#define TABLE_MAX_LOAD 0.75
+
 typedef struct {
     obj_string_t* key;
     value_t value;
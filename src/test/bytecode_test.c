@@ -1,6 +1,15 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "chunk.h"
+#include "compiler.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "serialize.h"
 #include "vm.h"
 #include "lib/debug.h"
+#include "lib/file.h"
 
 #include "test/bytecode_test.h"
 
@@ -43,8 +52,540 @@ static MunitResult _chunk_compare(const MunitParameter params[], void *user_data
 	return MUNIT_OK;
 }
 
+static MunitResult _line_table(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    chunk_t chunk;
+    l_init_chunk(&chunk);
+
+    int lines[] = {1, 1, 1, 2, 2, 5, 5, 5, 7};
+    int count = sizeof(lines) / sizeof(lines[0]);
+    for (int i = 0; i < count; i++) {
+        l_write_chunk(&chunk, OP_NIL, lines[i]);
+    }
+
+    // one entry per change of line
+    munit_assert_int(chunk.line_count, == , 4);
+    for (int i = 0; i < count; i++) {
+        munit_assert_int(l_get_line(&chunk, i), == , lines[i]);
+    }
+
+    // truncating drops the runs that start past the end
+    l_truncate_chunk(&chunk, 4);
+    munit_assert_int(chunk.line_count, == , 2);
+    l_write_chunk(&chunk, OP_NIL, 2);
+    l_write_chunk(&chunk, OP_NIL, 3);
+    munit_assert_int(chunk.line_count, == , 3);
+    munit_assert_int(l_get_line(&chunk, 4), == , 2);
+    munit_assert_int(l_get_line(&chunk, 5), == , 3);
+
+    l_free_chunk(&chunk);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _shared_string_constants(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    obj_function_t* function = l_compile(
+        "var total = 1;\n"
+        "total = total + total;\n"
+        "print \"total\";\n"
+        "print total;\n"
+    );
+    munit_assert_not_null(function);
+
+    // 'total' (identifier and literal) and 1
+    munit_assert_int(function->chunk.constants.count, == , 2);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _constant_folding(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    obj_function_t* function = l_compile("print 60 * 60 * 24;");
+    munit_assert_not_null(function);
+
+    chunk_t* chunk = &function->chunk;
+    munit_assert_int(chunk->code[0], == , OP_CONSTANT);
+    munit_assert_int(chunk->code[2], == , OP_PRINT);
+    munit_assert_int(chunk->constants.count, == , 1);
+    munit_assert_double(AS_NUMBER(chunk->constants.values[chunk->code[1]]), == , 86400);
+
+    function = l_compile("print -(1) + 2 < 3;");
+    munit_assert_not_null(function);
+    munit_assert_int(function->chunk.code[0], == , OP_TRUE);
+    munit_assert_int(function->chunk.code[1], == , OP_PRINT);
+
+    function = l_compile("print \"con\" + \"cat\" == \"concat\";");
+    munit_assert_not_null(function);
+    munit_assert_int(function->chunk.code[0], == , OP_TRUE);
+
+    // invalid operand types are left for the VM to report
+    function = l_compile("print 1 + \"a\";");
+    munit_assert_not_null(function);
+    munit_assert_int(function->chunk.code[4], == , OP_ADD);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _optimizer_passes(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+    l_set_optimize_level(OPTIMIZE_LEVEL_MAX);
+
+    // the dead branch, its jumps and the tested constant are all removed
+    obj_function_t* function = l_compile("if (false) print 1; print 2;");
+    munit_assert_not_null(function);
+
+    chunk_t* chunk = &function->chunk;
+    munit_assert_int(chunk->count, == , 5);
+    munit_assert_int(chunk->code[0], == , OP_CONSTANT);
+    munit_assert_double(AS_NUMBER(chunk->constants.values[chunk->code[1]]), == , 2);
+    munit_assert_int(chunk->code[2], == , OP_PRINT);
+    munit_assert_int(chunk->code[3], == , OP_NIL);
+    munit_assert_int(chunk->code[4], == , OP_RETURN);
+
+    // the loop condition disappears but the back edge remains
+    function = l_compile("while (true) { print 1; }");
+    munit_assert_not_null(function);
+    chunk = &function->chunk;
+    munit_assert_int(chunk->code[0], == , OP_CONSTANT);
+    munit_assert_int(chunk->code[2], == , OP_PRINT);
+    munit_assert_int(chunk->code[3], == , OP_LOOP);
+    munit_assert_int((chunk->code[4] << 8) | chunk->code[5], == , 6);
+    munit_assert_int(chunk->count, == , 6);
+
+    l_set_optimize_level(0);
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _register_instructions(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+    l_set_optimize_level(OPTIMIZE_LEVEL_MAX);
+
+    obj_function_t* function = l_compile(
+        "{\n"
+        "    var a = 1;\n"
+        "    var b = 2;\n"
+        "    a = a + b;\n"
+        "    print a < 3;\n"
+        "}\n"
+    );
+    munit_assert_not_null(function);
+
+    // a = a + b
+    chunk_t* chunk = &function->chunk;
+    munit_assert_int(chunk->code[4], == , OP_STORE_BINARY_LL);
+    munit_assert_int(chunk->code[5], == , OP_ADD);
+    munit_assert_int(chunk->code[6], == , 1);
+    munit_assert_int(chunk->code[7], == , 1);
+    munit_assert_int(chunk->code[8], == , 2);
+
+    // a < 3
+    munit_assert_int(chunk->code[9], == , OP_BINARY_LK);
+    munit_assert_int(chunk->code[10], == , OP_LESS);
+    munit_assert_int(chunk->code[11], == , 1);
+    munit_assert_double(AS_NUMBER(chunk->constants.values[chunk->code[12]]), == , 3);
+    munit_assert_int(chunk->code[13], == , OP_PRINT);
+
+    l_set_optimize_level(0);
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static obj_function_t* _find_function(chunk_t* chunk, const char* name) {
+    for (int i = 0; i < chunk->constants.count; i++) {
+        value_t constant = chunk->constants.values[i];
+        if (IS_FUNCTION(constant) && strcmp(AS_FUNCTION(constant)->name->chars, name) == 0)
+            return AS_FUNCTION(constant);
+    }
+    return NULL;
+}
+
+static MunitResult _inline_analysis(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    obj_function_t* function = l_compile(
+        "fun add(a, b) { return a + b; }\n"
+        "fun half(a) { return a / 2; }\n"
+        "fun first(a, b) { return a; }\n"
+        "fun answer() { return 42; }\n"
+        "fun noisy(a) { print a; return a; }\n"
+    );
+    munit_assert_not_null(function);
+
+    chunk_t* chunk = &function->chunk;
+    obj_function_t* add = _find_function(chunk, "add");
+    munit_assert_int(add->inline_kind, == , INLINE_BINARY_LL);
+    munit_assert_int(add->inline_op, == , OP_ADD);
+    munit_assert_int(add->inline_a, == , 1);
+    munit_assert_int(add->inline_b, == , 2);
+
+    munit_assert_int(_find_function(chunk, "half")->inline_kind, == , INLINE_BINARY_LK);
+    munit_assert_int(_find_function(chunk, "first")->inline_kind, == , INLINE_PARAMETER);
+    munit_assert_int(_find_function(chunk, "answer")->inline_kind, == , INLINE_CONSTANT);
+    munit_assert_int(_find_function(chunk, "noisy")->inline_kind, == , INLINE_NONE);
+
+    // the script itself is never inlined
+    munit_assert_int(function->inline_kind, == , INLINE_NONE);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static void _assert_same_function(obj_function_t* expected, obj_function_t* actual) {
+    munit_assert_int(actual->arity, == , expected->arity);
+    munit_assert_int(actual->upvalue_count, == , expected->upvalue_count);
+    if (expected->name == NULL) {
+        munit_assert_null(actual->name);
+    } else {
+        munit_assert_string_equal(actual->name->chars, expected->name->chars);
+    }
+    munit_assert_int(actual->inline_kind, == , expected->inline_kind);
+
+    chunk_t* a = &expected->chunk;
+    chunk_t* b = &actual->chunk;
+    munit_assert_int(b->count, == , a->count);
+    munit_assert_memory_equal(a->count, b->code, a->code);
+    munit_assert_int(b->line_count, == , a->line_count);
+    munit_assert_memory_equal(a->line_count * sizeof(line_start_t), b->lines, a->lines);
+
+    munit_assert_int(b->constants.count, == , a->constants.count);
+    for (int i = 0; i < a->constants.count; i++) {
+        value_t constant = a->constants.values[i];
+        if (IS_FUNCTION(constant)) {
+            munit_assert_true(IS_FUNCTION(b->constants.values[i]));
+            _assert_same_function(AS_FUNCTION(constant), AS_FUNCTION(b->constants.values[i]));
+        } else {
+            // strings are interned, so identical constants are the same object
+            munit_assert_true(l_values_equal(constant, b->constants.values[i]));
+        }
+    }
+}
+
+static MunitResult _serialize_roundtrip(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    obj_function_t* function = l_compile(
+        "var greeting = \"hello\";\n"
+        "fun counter(start) {\n"
+        "    var count = start;\n"
+        "    fun next() { count = count + 1.5; return count; }\n"
+        "    return next;\n"
+        "}\n"
+        "var tick = counter(2);\n"
+        "print tick() > 3 and greeting != nil;\n"
+    );
+    munit_assert_not_null(function);
+    l_push(OBJ_VAL(function));
+
+    uint8_t* data;
+    size_t size;
+    munit_assert_true(l_serialize_function(function, &data, &size));
+    munit_assert_true(l_is_bytecode(data, size));
+
+    obj_function_t* loaded = l_deserialize_function(data, size);
+    munit_assert_not_null(loaded);
+    _assert_same_function(function, loaded);
+
+    // truncated files are rejected rather than half loaded
+    munit_assert_null(l_deserialize_function(data, size / 2));
+
+    // a mapped image is used in place
+    const char* path = "build/serialize_roundtrip.loxc";
+    FILE* file = fopen(path, "wb");
+    munit_assert_not_null(file);
+    munit_assert_size(fwrite(data, 1, size, file), == , size);
+    fclose(file);
+    free(data);
+
+    obj_function_t* mapped = l_load_bytecode_file(path);
+    remove(path);
+    munit_assert_not_null(mapped);
+    munit_assert_true(mapped->chunk.mapped);
+    _assert_same_function(function, mapped);
+
+    l_pop();
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+// runs a loaded script in the VM it was loaded into and returns the number
+// it leaves in the global result
+static double _run_loaded(obj_function_t* function) {
+    munit_assert_not_null(function);
+    munit_assert_int(l_interpret_function(function), == , INTERPRET_OK);
+
+    value_t result;
+    munit_assert_true(l_table_get(&vm.globals, l_copy_interned_string("result", 6), &result));
+    munit_assert_true(IS_NUMBER(result));
+    return AS_NUMBER(result);
+}
+
+static MunitResult _serialize_execute(const MunitParameter params[], void *user_data)
+{
+	(void)user_data;
+
+    l_set_optimize_level(atoi(munit_parameters_get(params, "optimize")));
+#ifdef LOX_JIT
+    l_set_jit_enabled(strcmp(munit_parameters_get(params, "jit"), "on") == 0);
+#endif
+    l_init_vm();
+
+    // classes, closures, tail calls and a loop hot enough for the JIT
+    obj_function_t* function = l_compile(
+        "class Counter {\n"
+        "    init(start) { this.count = start; }\n"
+        "    add(n) { this.count = this.count + n; return this; }\n"
+        "}\n"
+        "fun makeAdder(n) { fun add(x) { return x + n; } return add; }\n"
+        "fun sum(n, total) { if (n == 0) return total; return sum(n - 1, total + n); }\n"
+        "var adder = makeAdder(2);\n"
+        "var counter = Counter(0);\n"
+        "for (var i = 0; i < 1000; i = i + 1) { counter.add(adder(i)); }\n"
+        "var result = counter.count + sum(100, 0);\n"
+    );
+    munit_assert_not_null(function);
+    l_push(OBJ_VAL(function));
+
+    uint8_t* data;
+    size_t size;
+    munit_assert_true(l_serialize_function(function, &data, &size));
+    l_pop();
+    l_free_vm();
+
+    // loaded into fresh VMs so nothing is left over from the compile
+    l_init_vm();
+    munit_assert_double(_run_loaded(l_deserialize_function(data, size)), == , 506550);
+    l_free_vm();
+
+    const char* path = "build/serialize_execute.loxc";
+    FILE* file = fopen(path, "wb");
+    munit_assert_not_null(file);
+    munit_assert_size(fwrite(data, 1, size, file), == , size);
+    fclose(file);
+    free(data);
+
+    l_init_vm();
+    obj_function_t* mapped = l_load_bytecode_file(path);
+    munit_assert_not_null(mapped);
+    munit_assert_true(mapped->chunk.mapped);
+    munit_assert_double(_run_loaded(mapped), == , 506550);
+    l_free_vm();
+    remove(path);
+
+    l_set_optimize_level(0);
+#ifdef LOX_JIT
+    l_set_jit_enabled(false);
+#endif
+
+	return MUNIT_OK;
+}
+
+static void _write_source(const char* path, const char* source) {
+    FILE* file = fopen(path, "w");
+    munit_assert_not_null(file);
+    fputs(source, file);
+    fclose(file);
+}
+
+static MunitResult _recompile_mapped(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    const char* source = "build/recompile_mapped.lox";
+    const char* output = "build/recompile_mapped.loxc";
+    _write_source(source, "var result = 1;\n");
+    munit_assert_int(l_compile_file(source, output), == , 0);
+    obj_function_t* mapped = l_load_bytecode_file(output);
+    munit_assert_not_null(mapped);
+
+    // recompiling replaces the file, the running image keeps the old one
+    l_push(OBJ_VAL(mapped));
+    _write_source(source, "var other = 1;\nvar result = other + 1;\n");
+    munit_assert_int(l_compile_file(source, output), == , 0);
+    l_pop();
+    munit_assert_double(_run_loaded(mapped), == , 1);
+    munit_assert_double(_run_loaded(l_load_bytecode_file(output)), == , 2);
+
+    l_free_vm();
+    remove(source);
+    remove(output);
+
+	return MUNIT_OK;
+}
+
+// whether the image loads, copied and mapped from a file, which must agree
+static bool _loads_image(const uint8_t* data, size_t size) {
+    bool copied = l_deserialize_function(data, size) != NULL;
+
+    const char* path = "build/serialize_validation.loxc";
+    FILE* file = fopen(path, "wb");
+    munit_assert_not_null(file);
+    munit_assert_size(fwrite(data, 1, size, file), == , size);
+    fclose(file);
+    bool mapped = l_load_bytecode_file(path) != NULL;
+    remove(path);
+
+    munit_assert_int(copied, == , mapped);
+    return copied;
+}
+
+static bool _loads(obj_function_t* function) {
+    uint8_t* data;
+    size_t size;
+    munit_assert_true(l_serialize_function(function, &data, &size));
+    bool loads = _loads_image(data, size);
+    free(data);
+    return loads;
+}
+
+static int _find_op(chunk_t* chunk, uint8_t op) {
+    for (int offset = 0; offset < chunk->count; offset += l_instruction_length(chunk, offset)) {
+        if (chunk->code[offset] == op)
+            return offset;
+    }
+    munit_error("instruction not found");
+    return -1;
+}
+
+static MunitResult _serialize_validation(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    obj_function_t* script = l_compile(
+        "var total = 1;\n"
+        "fun id(x) { return x; }\n"
+        "fun outer() { var v = 1; fun inner() { return v; } return inner; }\n"
+        "while (total < 3) total = total + id(1);\n"
+    );
+    munit_assert_not_null(script);
+    l_push(OBJ_VAL(script));
+    munit_assert_true(_loads(script));
+
+    // each operand is corrupted in turn and put back
+    chunk_t* chunk = &script->chunk;
+    int constant = _find_op(chunk, OP_CONSTANT) + 1;
+    uint8_t saved = chunk->code[constant];
+    chunk->code[constant] = (uint8_t)chunk->constants.count;
+    munit_assert_false(_loads(script));
+    chunk->code[constant] = saved;
+
+    // a jump before the start and one into the middle of an instruction
+    int loop = _find_op(chunk, OP_LOOP) + 1;
+    saved = chunk->code[loop];
+    chunk->code[loop] = 0xff;
+    munit_assert_false(_loads(script));
+    chunk->code[loop] = saved;
+    chunk->code[loop + 1]--;
+    munit_assert_false(_loads(script));
+    chunk->code[loop + 1]++;
+
+    obj_function_t* inner = _find_function(&_find_function(chunk, "outer")->chunk, "inner");
+    munit_assert_not_null(inner);
+    int upvalue = _find_op(&inner->chunk, OP_GET_UPVALUE) + 1;
+    inner->chunk.code[upvalue] = 1;
+    munit_assert_false(_loads(script));
+    inner->chunk.code[upvalue] = 0;
+
+    obj_function_t* id = _find_function(chunk, "id");
+    munit_assert_int(id->inline_kind, == , INLINE_PARAMETER);
+    id->inline_a = 2;
+    munit_assert_false(_loads(script));
+    id->inline_a = 1;
+
+    script->arity = 1;
+    munit_assert_false(_loads(script));
+    script->arity = 0;
+
+    // a string's stored hash, a mapped string is interned under it
+    uint8_t* data;
+    size_t size;
+    munit_assert_true(l_serialize_function(script, &data, &size));
+    size_t name = 0;
+    while (name + 6 <= size && memcmp(data + name, "total", 6) != 0)
+        name++;
+    munit_assert_size(name + 6, <= , size);
+    data[name - 1] ^= 0x01;
+    munit_assert_false(_loads_image(data, size));
+    free(data);
+
+    munit_assert_true(_loads(script));
+
+    l_pop();
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
 MunitSuite l_bytecode_test_setup() {
 
+    static char* optimize[] = {
+        "0",
+        "3",
+        NULL,
+    };
+
+    static char* jit[] = {
+        "off",
+#ifdef LOX_JIT
+        "on",
+#endif
+        NULL,
+    };
+
+    static MunitParameterEnum executeParams[] = {
+        {"optimize", optimize},
+        {"jit", jit},
+        {NULL, NULL},
+    };
+
     static MunitTest bytecode_suite_tests[] = {
         {
             .name = (char *)"basic_chunk_compare", 
@@ -54,6 +595,86 @@ MunitSuite l_bytecode_test_setup() {
             .options = MUNIT_TEST_OPTION_NONE,
             .parameters = NULL
         },
+        {
+            .name = (char *)"constant_folding", 
+            .test = _constant_folding, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"inline_analysis", 
+            .test = _inline_analysis, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"line_table", 
+            .test = _line_table, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"optimizer_passes", 
+            .test = _optimizer_passes, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"recompile_mapped", 
+            .test = _recompile_mapped, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"register_instructions", 
+            .test = _register_instructions, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"serialize_roundtrip", 
+            .test = _serialize_roundtrip, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"serialize_execute", 
+            .test = _serialize_execute, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = executeParams
+        },
+        {
+            .name = (char *)"serialize_validation", 
+            .test = _serialize_validation, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
+        {
+            .name = (char *)"shared_string_constants", 
+            .test = _shared_string_constants, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL
+        },
 
         // END
         {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
@@ -12,6 +12,9 @@ int main(int argc, const char* argv[]) {
         l_vm_test_setup(),
         l_bytecode_test_setup(),
         l_scripts_test_setup(),
+
+        // END
+        {NULL, NULL, NULL, 0, MUNIT_SUITE_OPTION_NONE},
     };
 
     /* Now we'll actually declare the test suite.  You could do this in
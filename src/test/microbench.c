@@ -0,0 +1,329 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "object.h"
+#include "table.h"
+#include "value.h"
+#include "vm.h"
+#include "lib/clock.h"
+#include "lib/memory.h"
+
+// Times the VM's internal data structures in isolation. Each benchmark is
+// run at several sizes, a batch of iterations is calibrated to take about
+// MICRO_SAMPLE_NS and MICRO_SAMPLES batches are timed after a warm up.
+// Results are written as CSV to stdout, times are nanoseconds per
+// operation.
+//
+//   microbench [name filter]
+
+#define MICRO_SAMPLES   21
+#define MICRO_SAMPLE_NS 10000000  // 10ms
+
+typedef struct {
+    const char* name;
+    int         sizes[4];  // a 0 ends the list early
+    void        (*setup)(int size);
+    uint64_t    (*run)(int size);  // returns the number of operations done
+    void        (*teardown)(int size);
+} micro_benchmark_t;
+
+// -- fixtures, objects are kept on the VM stack so collections don't free them
+
+// adds the value to the fixture's list, it's on the stack while the list grows
+static void _keep(obj_list_t* list, value_t value) {
+    l_push(value);
+    l_write_value_array(&list->items, value);
+    l_pop();
+}
+
+static obj_string_t** _keys = NULL;
+static char**         _chars = NULL;
+static table_t        _table;
+
+static void _make_keys(int size) {
+    obj_list_t* list = l_new_list();
+    l_push(OBJ_VAL(list));
+
+    _keys = malloc(sizeof(obj_string_t*) * size);
+    _chars = malloc(sizeof(char*) * size);
+    for (int i = 0; i < size; i++) {
+        char name[32];
+        int length = snprintf(name, sizeof(name), "key%d", i);
+        _keys[i] = l_copy_interned_string(name, length);
+        _keep(list, OBJ_VAL(_keys[i]));
+        _chars[i] = _keys[i]->chars;
+    }
+}
+
+static void _free_keys(int size) {
+    (void)size;
+    free(_keys);
+    free(_chars);
+    _keys = NULL;
+    _chars = NULL;
+    l_pop();
+}
+
+static void _fill_table(int size) {
+    _make_keys(size);
+    l_init_table(&_table);
+    for (int i = 0; i < size; i++) {
+        l_table_set(&_table, _keys[i], NUMBER_VAL(i));
+    }
+}
+
+static void _free_table(int size) {
+    l_free_table(&_table);
+    _free_keys(size);
+}
+
+// -- benchmarks
+
+static uint64_t _table_set(int size) {
+    table_t table;
+    l_init_table(&table);
+    for (int i = 0; i < size; i++) {
+        l_table_set(&table, _keys[i], NUMBER_VAL(i));
+    }
+    l_free_table(&table);
+    return size;
+}
+
+static uint64_t _table_get(int size) {
+    value_t value;
+    int found = 0;
+    for (int i = 0; i < size; i++) {
+        found += l_table_get(&_table, _keys[i], &value);
+    }
+    return found;
+}
+
+// looking up strings that are already interned, as the compiler does for
+// every identifier
+static uint64_t _intern_hit(int size) {
+    for (int i = 0; i < size; i++) {
+        l_copy_interned_string(_chars[i], _keys[i]->length);
+    }
+    return size;
+}
+
+// new strings that are unreachable once interned, the cost includes the
+// collections that free them
+static uint64_t _intern_miss(int size) {
+    static uint64_t counter = 0;
+    for (int i = 0; i < size; i++) {
+        char name[32];
+        int length = snprintf(name, sizeof(name), "miss%llu", (unsigned long long)counter++);
+        l_copy_interned_string(name, length);
+    }
+    return size;
+}
+
+#define MICRO_ALLOCATIONS 64
+
+static uint64_t _reallocate(int size) {
+    void* blocks[MICRO_ALLOCATIONS];
+    for (int i = 0; i < MICRO_ALLOCATIONS; i++) {
+        blocks[i] = reallocate(NULL, 0, size);
+    }
+    for (int i = 0; i < MICRO_ALLOCATIONS; i++) {
+        reallocate(blocks[i], size, 0);
+    }
+    return MICRO_ALLOCATIONS;
+}
+
+static void _push_slots(int size) {
+    for (int i = 0; i < size; i++) {
+        l_push(NUMBER_VAL(i));
+    }
+}
+
+static void _pop_slots(int size) {
+    l_close_upvalues(vm.stack);
+    vm.stack_top -= size;
+}
+
+// capturing new upvalues for the latest slots, as closures are created,
+// then closing them all
+static uint64_t _capture_upvalue(int size) {
+    value_t* first = vm.stack_top - size;
+    for (int i = 0; i < size; i++) {
+        l_capture_upvalue(first + i);
+    }
+    l_close_upvalues(first);
+    return size;
+}
+
+static void _open_upvalues(int size) {
+    _push_slots(size);
+    value_t* first = vm.stack_top - size;
+    for (int i = 0; i < size; i++) {
+        l_capture_upvalue(first + i);
+    }
+}
+
+// finding slots that already have an open upvalue, the list is walked
+// from the top of the stack down
+static uint64_t _capture_upvalue_hit(int size) {
+    value_t* first = vm.stack_top - size;
+    for (int i = 0; i < size; i++) {
+        l_capture_upvalue(first + i);
+    }
+    return size;
+}
+
+static void _make_heap(int size) {
+    obj_list_t* list = l_new_list();
+    l_push(OBJ_VAL(list));
+
+    obj_string_t* name = l_copy_interned_string("Node", 4);
+    _keep(list, OBJ_VAL(name));
+    obj_class_t* klass = l_new_class(name);
+    _keep(list, OBJ_VAL(klass));
+    obj_string_t* field = l_copy_interned_string("value", 5);
+    _keep(list, OBJ_VAL(field));
+
+    for (int i = 0; i < size; i++) {
+        obj_instance_t* instance = l_new_instance(klass);
+        _keep(list, OBJ_VAL(instance));
+        l_table_set(&instance->fields, field, NUMBER_VAL(i));
+    }
+}
+
+static void _free_heap(int size) {
+    (void)size;
+    l_pop();
+}
+
+// a full mark and sweep with size live instances
+static uint64_t _collect_garbage(int size) {
+    (void)size;
+    l_collect_garbage();
+    return 1;
+}
+
+static micro_benchmark_t _benchmarks[] = {
+    { "table_set",           {16, 256, 4096, 65536}, _make_keys,   _table_set,           _free_keys  },
+    { "table_get",           {16, 256, 4096, 65536}, _fill_table,  _table_get,           _free_table },
+    { "intern_hit",          {16, 256, 4096, 65536}, _make_keys,   _intern_hit,          _free_keys  },
+    { "intern_miss",         {256, 0},               NULL,         _intern_miss,         NULL        },
+    { "reallocate",          {16, 256, 4096, 0},     NULL,         _reallocate,          NULL        },
+    { "capture_upvalue",     {1, 16, 256, 0},        _push_slots,  _capture_upvalue,     _pop_slots  },
+    { "capture_upvalue_hit", {1, 16, 256, 0},        _open_upvalues, _capture_upvalue_hit, _pop_slots },
+    { "collect_garbage",     {1000, 10000, 100000, 0}, _make_heap, _collect_garbage,     _free_heap  },
+};
+
+// -- statistics
+
+static int _compare_doubles(const void* a, const void* b) {
+    double left = *(const double*)a;
+    double right = *(const double*)b;
+    return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static double _median(double* sorted, int count) {
+    return count % 2 == 1 ? sorted[count / 2]
+                          : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+}
+
+// nanoseconds per operation for a batch of iterations
+static double _sample(micro_benchmark_t* benchmark, int size, uint64_t iterations) {
+    uint64_t operations = 0;
+    uint64_t start = l_now_ns();
+    for (uint64_t i = 0; i < iterations; i++) {
+        operations += benchmark->run(size);
+    }
+    uint64_t elapsed = l_now_ns() - start;
+    return operations == 0 ? 0 : (double)elapsed / operations;
+}
+
+// each size is measured in a fresh VM so earlier runs don't leave their
+// objects and interned strings behind
+static void _measure(micro_benchmark_t* benchmark, int size) {
+    l_init_vm();
+    if (benchmark->setup != NULL)
+        benchmark->setup(size);
+
+    // double the batch until it's long enough to time, which also warms
+    // the caches and the allocator
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+    for (;;) {
+        uint64_t start = l_now_ns();
+        for (uint64_t i = 0; i < iterations; i++) {
+            benchmark->run(size);
+        }
+        elapsed = l_now_ns() - start;
+        if (elapsed >= MICRO_SAMPLE_NS / 10)
+            break;
+        iterations *= 2;
+    }
+    iterations = iterations * MICRO_SAMPLE_NS / (elapsed > 0 ? elapsed : 1);
+    if (iterations == 0)
+        iterations = 1;
+
+    double samples[MICRO_SAMPLES];
+    for (int i = 0; i < MICRO_SAMPLES; i++) {
+        samples[i] = _sample(benchmark, size, iterations);
+    }
+
+    if (benchmark->teardown != NULL)
+        benchmark->teardown(size);
+    l_free_vm();
+
+    double mean = 0;
+    for (int i = 0; i < MICRO_SAMPLES; i++) {
+        mean += samples[i];
+    }
+    mean /= MICRO_SAMPLES;
+
+    double variance = 0;
+    for (int i = 0; i < MICRO_SAMPLES; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean);
+    }
+    double stddev = sqrt(variance / (MICRO_SAMPLES - 1));
+
+    qsort(samples, MICRO_SAMPLES, sizeof(double), _compare_doubles);
+    double median = _median(samples, MICRO_SAMPLES);
+
+    // the median absolute deviation, unlike the standard deviation it
+    // isn't thrown off by the odd sample interrupted by the OS
+    double deviations[MICRO_SAMPLES];
+    for (int i = 0; i < MICRO_SAMPLES; i++) {
+        deviations[i] = fabs(samples[i] - median);
+    }
+    qsort(deviations, MICRO_SAMPLES, sizeof(double), _compare_doubles);
+    double mad = _median(deviations, MICRO_SAMPLES);
+
+    printf("%s,%d,%d,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+           benchmark->name,
+           size,
+           MICRO_SAMPLES,
+           (unsigned long long)iterations,
+           median,
+           mad,
+           mean,
+           stddev,
+           samples[0],
+           samples[MICRO_SAMPLES - 1]);
+    fflush(stdout);
+}
+
+int main(int argc, const char* argv[]) {
+    const char* filter = argc > 1 ? argv[1] : NULL;
+
+    printf("benchmark,size,samples,iterations,median_ns,mad_ns,mean_ns,stddev_ns,min_ns,max_ns\n");
+    for (size_t i = 0; i < sizeof(_benchmarks) / sizeof(_benchmarks[0]); i++) {
+        micro_benchmark_t* benchmark = &_benchmarks[i];
+        if (filter != NULL && strstr(benchmark->name, filter) == NULL)
+            continue;
+
+        for (int s = 0; s < 4 && benchmark->sizes[s] != 0; s++) {
+            _measure(benchmark, benchmark->sizes[s]);
+        }
+    }
+
+    return 0;
+}
@@ -1,4 +1,9 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "chunk.h"
+#include "jit.h"
+#include "optimizer.h"
 #include "vm.h"
 
 #include "lib/debug.h"
@@ -18,14 +23,24 @@ static MunitResult _run_file(const MunitParameter params[], void *user_data)
 {
 	(void)user_data;
 	
-    char* filename = params[0].value;
-
+    const char* filename = munit_parameters_get(params, "files");
+    const char* optimize = munit_parameters_get(params, "optimize");
+    const char* jit = munit_parameters_get(params, "jit");
+
+    l_set_optimize_level(atoi(optimize));
+#ifdef LOX_JIT
+    l_set_jit_enabled(strcmp(jit, "on") == 0);
+#endif
     l_init_vm();
 
-    munit_logf(MUNIT_LOG_WARNING , "running script: %s", filename);
+    munit_logf(MUNIT_LOG_WARNING , "running script: %s -O%s jit %s", filename, optimize, jit);
     int status = l_run_file(filename);
 
     l_free_vm();
+    l_set_optimize_level(0);
+#ifdef LOX_JIT
+    l_set_jit_enabled(false);
+#endif
 
     munit_assert_int(status, == , 0);
 
@@ -43,11 +58,39 @@ MunitSuite l_scripts_test_setup() {
         "src/test/scripts/control.lox",
         "src/test/scripts/funcs.lox",
         "src/test/scripts/globals.lox",
+        "src/test/scripts/lists.lox",
+        "src/test/scripts/maps.lox",
+        "src/test/scripts/buffers.lox",
+        "src/test/scripts/tailcalls.lox",
+        "src/test/scripts/inline.lox",
+        "src/test/scripts/jit.lox",
+        "src/test/scripts/trace.lox",
+        "src/test/scripts/gcstats.lox",
+        "src/test/scripts/collector.lox",
+        NULL,
+    };
+
+    // every script is run with and without the optimizer
+    static char* optimize[] = {
+        "0",
+        "2",
+        "3",
+        NULL,
+    };
+
+    // and with native code generation where it is available
+    static char* jit[] = {
+        "off",
+#ifdef LOX_JIT
+        "on",
+#endif
         NULL,
     };
 
     static MunitParameterEnum params[] = {
         {"files", files},
+        {"optimize", optimize},
+        {"jit", jit},
         NULL,
     };
 
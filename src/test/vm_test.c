@@ -1,9 +1,20 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "chunk.h"
+#include "coverage.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "perf.h"
+#include "profiler.h"
+#include "timeline.h"
 #include "vm.h"
 #include "test/vm_test.h"
 
 #include "lib/debug.h"
 #include "lib/file.h"
+#include "lib/heap.h"
+#include "lib/memory.h"
 
 #include "test/scripts_test.h"
 
@@ -29,6 +40,586 @@ static MunitResult _run_vm(const MunitParameter params[], void *user_data)
 
 
 
+static MunitResult _collect_on_growth(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    // the sweep frees objects while the heap is still over the threshold,
+    // a free that started a collection would re-enter the sweep
+    void* block = reallocate(NULL, 0, 64);
+    block = reallocate(block, 64, 128);
+    uint64_t collections = vm.gc_stats.collections;
+
+    vm.next_gc = 0;
+    block = reallocate(block, 128, 32);
+    munit_assert_int(vm.gc_stats.collections, == , collections);
+    reallocate(block, 32, 0);
+    munit_assert_int(vm.gc_stats.collections, == , collections);
+
+    // growing still does
+    block = reallocate(NULL, 0, 64);
+    munit_assert_int(vm.gc_stats.collections, == , collections + 1);
+    reallocate(block, 64, 0);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _string_interning(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    obj_string_t* a = l_copy_string("lazy", 4);
+    l_push(OBJ_VAL(a));
+    obj_string_t* b = l_copy_string("lazy", 4);
+    l_push(OBJ_VAL(b));
+
+    // strings are not interned on creation but still compare equal
+    munit_assert_ptr_not_equal(a, b);
+    munit_assert_false(a->is_interned);
+    munit_assert_false(b->is_interned);
+    munit_assert_true(l_values_equal(OBJ_VAL(a), OBJ_VAL(b)));
+
+    obj_string_t* internedA = l_intern_string(a);
+    obj_string_t* internedB = l_intern_string(b);
+    munit_assert_ptr_equal(internedA, a);
+    munit_assert_ptr_equal(internedB, a);
+    munit_assert_true(a->is_interned);
+
+    obj_string_t* other = l_copy_string("other", 5);
+    munit_assert_false(l_values_equal(OBJ_VAL(a), OBJ_VAL(other)));
+
+    l_pop();
+    l_pop();
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+#ifdef LOX_PROFILER
+static MunitResult _profiler(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    const char* path = "build/profiler_test.folded";
+    munit_assert_true(l_start_profiler(path));
+    InterpretResult result = l_interpret(
+        "fun spin(n) {\n"
+        "    var total = 0;\n"
+        "    for (var i = 0; i < n; i = i + 1) total = total + i;\n"
+        "    return total;\n"
+        "}\n"
+        "spin(1000000);\n"
+    );
+    l_stop_profiler();
+    munit_assert_int(result, == , INTERPRET_OK);
+
+    // every sample is a collapsed stack rooted at the script, the time is
+    // spent in spin called from line 6
+    FILE* file = fopen(path, "r");
+    munit_assert_not_null(file);
+    char line[256];
+    int spinning = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        munit_assert_true(strncmp(line, "script:", 7) == 0);
+        if (strncmp(line, "script:6;spin:", 14) == 0)
+            spinning += atoi(strrchr(line, ' ') + 1);
+    }
+    fclose(file);
+    remove(path);
+    munit_assert_int(spinning, > , 0);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+#endif
+
+static MunitResult _index_range(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    // indices that don't fit an int are rejected before they're converted
+    const char* scripts[] = {
+        "[1, 2][2];",
+        "[1, 2][-1];",
+        "[1, 2][0.5];",
+        "[1, 2][100000000000];",
+        "[1, 2][-100000000000];",
+        "[1, 2][0 / 0];",
+        "[1, 2][1 / 0];",
+        "var list = [1, 2]; list[4294967296] = 3;",
+        "buffer(\"u8\", 2)[2];",
+        "buffer(\"u8\", 2)[0.5];",
+        "buffer(\"u8\", 2)[0 / 0];",
+        "var bytes = buffer(\"u8\", 2); bytes[-100000000000] = 1;",
+    };
+    for (size_t i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++) {
+        munit_assert_int(l_interpret(scripts[i]), == , INTERPRET_RUNTIME_ERROR);
+    }
+    munit_assert_int(l_interpret("var list = [1, 2]; list[1] = list[0];"), == , INTERPRET_OK);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _assert_native(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    // the test scripts' checks, a failed one is a runtime error
+    munit_assert_int(l_interpret("assert(1 + 1 == 2, \"sum\"); assert(0);"), == , INTERPRET_OK);
+    munit_assert_int(l_interpret("assert(1 + 1 == 3, \"sum\");"), == , INTERPRET_RUNTIME_ERROR);
+    munit_assert_int(l_interpret("fun f() { return assert(nil); } f();"), == , INTERPRET_RUNTIME_ERROR);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _heap_snapshot(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    InterpretResult result = l_interpret(
+        "class Node { init(next) { this.next = next; } }\n"
+        "class Point { init(x, y) { this.x = x; this.y = y; } }\n"
+        "var head = nil;\n"
+        "for (var i = 0; i < 10; i = i + 1) head = Node(head);\n"
+        "var points = [Point(1, 2), Point(3, 4), Point(5, 6)];\n"
+    );
+    munit_assert_int(result, == , INTERPRET_OK);
+
+    const char* path = "build/heap_test.snapshot";
+    munit_assert_true(l_write_heap_snapshot(path));
+
+    FILE* file = fopen(path, "r");
+    munit_assert_not_null(file);
+
+    char line[512];
+    char section[32] = "";
+    int nodes = 0;
+    int points = 0;
+    int head = -1;
+    size_t census_bytes = 0;
+    size_t node_bytes = 0;
+    size_t head_retained = 0;
+    size_t head_size = 0;
+    munit_assert_not_null(fgets(line, sizeof(line), file));
+    munit_assert_true(strncmp(line, "# lox heap snapshot", 19) == 0);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (line[0] == '#') {
+            sscanf(line, "# %31s", section);
+            fgets(line, sizeof(line), file); // column names
+            continue;
+        }
+
+        char name[64];
+        int count;
+        size_t bytes;
+        if (strcmp(section, "census") == 0) {
+            munit_assert_int(sscanf(strrchr(line, '\t') + 1, "%zu", &bytes), == , 1);
+            census_bytes += bytes;
+        } else if (strcmp(section, "classes") == 0) {
+            munit_assert_int(sscanf(line, "%63s\t%d\t%zu", name, &count, &bytes), == , 3);
+            if (strcmp(name, "Node") == 0) {
+                nodes = count;
+                node_bytes = bytes;
+            } else if (strcmp(name, "Point") == 0) {
+                points = count;
+            }
+        } else if (strcmp(section, "roots") == 0) {
+            if (strncmp(line, "global head\t", 12) == 0)
+                head = atoi(line + 13);
+        } else if (strcmp(section, "objects") == 0) {
+            if (line[0] == '@' && atoi(line + 1) == head) {
+                char type[32];
+                munit_assert_int(sscanf(line, "@%*d\t%31[^\t]\t%zu\t%zu", type, &head_size, &head_retained), == , 3);
+                munit_assert_string_equal(type, "Instance");
+            }
+        }
+    }
+    fclose(file);
+    remove(path);
+
+    munit_assert_int(nodes, == , 10);
+    munit_assert_int(points, == , 3);
+
+    // the list is only held by head so it retains every node, while the
+    // class and field names are shared with the rest of the heap
+    munit_assert_int(head, > , 0);
+    munit_assert_size(head_retained, >= , node_bytes);
+    munit_assert_size(head_retained, < , census_bytes);
+    munit_assert_size(head_size, < , head_retained);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _timeline(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    const char* path = "build/timeline_test.json";
+    munit_assert_true(l_timeline_start(path));
+
+    InterpretResult result = l_interpret(
+        "fun add(a, b) { var c = a + b; return c; }\n"
+        "var total = 0;\n"
+        "for (var i = 0; i < 10; i = i + 1) total = add(total, i);\n"
+        "clock();\n"
+    );
+    munit_assert_int(result, == , INTERPRET_OK);
+    l_collect_garbage();
+    l_timeline_stop();
+    munit_assert_false(vm.timeline_enabled);
+
+    FILE* file = fopen(path, "r");
+    munit_assert_not_null(file);
+
+    char line[512];
+    int begins = 0;
+    int ends = 0;
+    int adds = 0;
+    bool clock = false;
+    bool compile = false;
+    bool gc = false;
+    munit_assert_not_null(fgets(line, sizeof(line), file));
+    munit_assert_true(strncmp(line, "{\"traceEvents\":[", 16) == 0);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        begins += strstr(line, "\"ph\":\"B\"") != NULL;
+        ends += strstr(line, "\"ph\":\"E\"") != NULL;
+        adds += strstr(line, "\"name\":\"add\"") != NULL;
+        clock |= strstr(line, "\"cat\":\"native\"") != NULL && strstr(line, "\"name\":\"clock\"") != NULL;
+        compile |= strstr(line, "\"cat\":\"compile\"") != NULL;
+        gc |= strstr(line, "\"name\":\"mark\"") != NULL;
+    }
+    fclose(file);
+    remove(path);
+
+    munit_assert_int(adds, == , 10);
+    munit_assert_int(begins, == , ends);
+    munit_assert_true(clock);
+    munit_assert_true(compile);
+    munit_assert_true(gc);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _budget(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+    l_set_budget(100);
+
+    // one step for each of the 10000 back edges
+    InterpretResult result = l_interpret(
+        "var i = 0;\n"
+        "while (i < 10000) i = i + 1;\n"
+    );
+    int slices = 0;
+    while (result == INTERPRET_SUSPENDED) {
+        slices++;
+        munit_assert_true(vm.suspended);
+        result = l_resume();
+    }
+    munit_assert_int(result, == , INTERPRET_OK);
+    munit_assert_int(slices, == , 100);
+    munit_assert_int(l_resume(), == , INTERPRET_RUNTIME_ERROR);
+
+    value_t i;
+    munit_assert_true(l_table_get(&vm.globals, l_copy_interned_string("i", 1), &i));
+    munit_assert_double(AS_NUMBER(i), == , 10000);
+
+    // calls are counted too, so unbounded recursion is suspended before it
+    // overflows the stack
+    result = l_interpret(
+        "fun spin() { while (true) {} }\n"
+        "fun recurse(n) { return recurse(n + 1) + 1; }\n"
+        "spin();\n"
+    );
+    munit_assert_int(result, == , INTERPRET_SUSPENDED);
+    munit_assert_int(l_resume(), == , INTERPRET_SUSPENDED);
+    l_abort();
+    munit_assert_false(vm.suspended);
+    munit_assert_int(vm.frame_count, == , 0);
+
+    l_set_budget(50);
+    munit_assert_int(l_interpret("recurse(0);\n"), == , INTERPRET_SUSPENDED);
+    munit_assert_int(vm.frame_count, <= , 51);
+
+    // a new script replaces the suspended one
+    l_set_budget(0);
+    munit_assert_int(l_interpret("var done = true;\n"), == , INTERPRET_OK);
+    munit_assert_false(vm.suspended);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+static MunitResult _coverage(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    const char* path = "build/coverage_test.info";
+    munit_assert_true(l_start_coverage(path, "coverage.lox"));
+
+    InterpretResult result = l_interpret(
+        "fun absolute(n) {\n"
+        "    if (n >= 0) {\n"
+        "        return n;\n"
+        "    }\n"
+        "    return -n;\n"
+        "}\n"
+        "fun unused() {\n"
+        "    return 1;\n"
+        "}\n"
+        "var x = absolute(2);\n"
+    );
+    munit_assert_int(result, == , INTERPRET_OK);
+    l_stop_coverage();
+
+    FILE* file = fopen(path, "r");
+    munit_assert_not_null(file);
+
+    char line[512];
+    int hits[16];
+    memset(hits, -1, sizeof(hits));
+    int absolute = -1;
+    int unused = -1;
+    bool source = false;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        int number, count;
+        if (sscanf(line, "DA:%d,%d", &number, &count) == 2 && number < 16)
+            hits[number] = count;
+        else if (strncmp(line, "FNDA:", 5) == 0 && strstr(line, ",absolute:") != NULL)
+            absolute = atoi(line + 5);
+        else if (strncmp(line, "FNDA:", 5) == 0 && strstr(line, ",unused:") != NULL)
+            unused = atoi(line + 5);
+        source |= strcmp(line, "SF:coverage.lox\n") == 0;
+    }
+    fclose(file);
+    remove(path);
+
+    munit_assert_true(source);
+    munit_assert_int(absolute, == , 1);
+    munit_assert_int(unused, == , 0);
+    munit_assert_int(hits[2], == , 1);
+    munit_assert_int(hits[3], == , 1);
+    munit_assert_int(hits[5], == , 0);
+    munit_assert_int(hits[8], == , 0);
+    munit_assert_int(hits[10], == , 1);
+
+    // the code that didn't run is restored when coverage stops
+    munit_assert_int(l_interpret("x = absolute(-3) + unused();\n"), == , INTERPRET_OK);
+    value_t x;
+    munit_assert_true(l_table_get(&vm.globals, l_copy_interned_string("x", 1), &x));
+    munit_assert_double(AS_NUMBER(x), == , 4);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+
+#ifdef LOX_JIT
+static MunitResult _jit_set_global(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_set_jit_enabled(true);
+    l_init_vm();
+
+    // the box is only held by keep, a value native code pushed, when the
+    // native SET_GLOBAL grows the globals, with DEBUG_STRESS_GC that
+    // collects
+    InterpretResult result = l_interpret(
+        "class Box { init(value) { this.value = value; } }\n"
+        "var g = 0;\n"
+        "var ok = false;\n"
+        "fun swap(box) {\n"
+        "    var keep = box;\n"
+        "    box = nil;\n"
+        "    g = 1;\n"
+        "    return keep;\n"
+        "}\n"
+        "for (var i = 0; i < 100; i = i + 1) swap(nil);\n"
+    );
+    munit_assert_int(result, == , INTERPRET_OK);
+
+    value_t swap;
+    munit_assert_true(l_table_get(&vm.globals, l_copy_interned_string("swap", 4), &swap));
+    munit_assert_not_null(AS_CLOSURE(swap)->function->jit);
+
+    // fill the globals up to the point where the next set grows them
+    for (int i = 0; vm.globals.count + 1 <= vm.globals.capacity * TABLE_MAX_LOAD; i++) {
+        char name[32];
+        int length = snprintf(name, sizeof(name), "padding%d", i);
+        l_push(OBJ_VAL(l_copy_interned_string(name, length)));
+        l_table_set(&vm.globals, AS_STRING(vm.stack_top[-1]), NIL_VAL);
+        l_pop();
+    }
+
+    int capacity = vm.globals.capacity;
+    result = l_interpret("ok = swap(Box(\"kept\")).value == \"kept\";\n");
+    munit_assert_int(result, == , INTERPRET_OK);
+    munit_assert_int(vm.globals.capacity, > , capacity);
+
+    value_t ok;
+    munit_assert_true(l_table_get(&vm.globals, l_copy_interned_string("ok", 2), &ok));
+    munit_assert_true(AS_BOOL(ok));
+
+    l_free_vm();
+    l_set_jit_enabled(false);
+
+	return MUNIT_OK;
+}
+
+static MunitResult _jit_tail_calls(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_set_jit_enabled(true);
+    l_init_vm();
+
+    // called once, then only by tail calls that reuse its frame
+    InterpretResult result = l_interpret(
+        "fun count(n) {\n"
+        "    if (n == 0) return 0;\n"
+        "    return count(n - 1);\n"
+        "}\n"
+        "count(200);\n"
+    );
+    munit_assert_int(result, == , INTERPRET_OK);
+
+    value_t count;
+    munit_assert_true(l_table_get(&vm.globals, l_copy_interned_string("count", 5), &count));
+    munit_assert_not_null(AS_CLOSURE(count)->function->jit);
+
+    l_free_vm();
+    l_set_jit_enabled(false);
+
+	return MUNIT_OK;
+}
+
+static MunitResult _jit_trace_body_locals(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    // x is declared in the loop body so it's pushed again each iteration,
+    // the trace mustn't take it to still be the number it held last time
+    const char* script =
+        "var g = 1;\n"
+        "fun f() {\n"
+        "  var last = 0;\n"
+        "  for (var i = 0; i < 200; i = i + 1) {\n"
+        "    var x = g;\n"
+        "    var y = x - 1;\n"
+        "    last = y;\n"
+        "    if (i == 150) g = \"s\";\n"
+        "  }\n"
+        "  print last;\n"
+        "}\n"
+        "f();\n";
+
+    l_set_jit_enabled(true);
+    for (int level = 0; level <= OPTIMIZE_LEVEL_MAX; level += OPTIMIZE_LEVEL_MAX) {
+        l_set_optimize_level(level);
+        l_init_vm();
+        munit_assert_int(l_interpret(script), == , INTERPRET_RUNTIME_ERROR);
+        l_free_vm();
+    }
+    l_set_optimize_level(0);
+    l_set_jit_enabled(false);
+
+	return MUNIT_OK;
+}
+#endif
+
+#ifdef LOX_PERF
+static MunitResult _perf_counters(const MunitParameter params[], void *user_data)
+{
+	(void)params;
+	(void)user_data;
+
+    l_init_vm();
+
+    // most virtual machines and containers don't expose the hardware counters
+    if (!l_start_perf()) {
+        l_free_vm();
+        return MUNIT_SKIP;
+    }
+
+    InterpretResult result = l_interpret(
+        "fun spin(n) {\n"
+        "    var total = 0;\n"
+        "    for (var i = 0; i < n; i = i + 1) total = total + i;\n"
+        "    return total;\n"
+        "}\n"
+        "spin(1000000);\n"
+    );
+    munit_assert_int(result, == , INTERPRET_OK);
+
+    const char* path = "build/perf_test.txt";
+    FILE* file = fopen(path, "w+");
+    munit_assert_not_null(file);
+    l_stop_perf(file);
+
+    rewind(file);
+    char line[512];
+    bool run = false;
+    bool spin = false;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        run |= strncmp(line, "run 1 ", 6) == 0;
+        spin |= strncmp(line, "spin:", 5) == 0;
+    }
+    fclose(file);
+    remove(path);
+
+    munit_assert_true(run);
+    munit_assert_true(spin);
+
+    l_free_vm();
+
+	return MUNIT_OK;
+}
+#endif
+
 MunitSuite l_vm_test_setup() {
 
     static MunitTest bytecode_suite_tests[] = {
@@ -40,6 +631,116 @@ MunitSuite l_vm_test_setup() {
             .options = MUNIT_TEST_OPTION_NONE,
             .parameters = NULL,
         },
+        {
+            .name = (char *)"collect on growth", 
+            .test = _collect_on_growth, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"string interning", 
+            .test = _string_interning, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"assert native", 
+            .test = _assert_native, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"index range", 
+            .test = _index_range, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"heap snapshot", 
+            .test = _heap_snapshot, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"timeline", 
+            .test = _timeline, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"budget", 
+            .test = _budget, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"coverage", 
+            .test = _coverage, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+#ifdef LOX_PROFILER
+        {
+            .name = (char *)"profiler", 
+            .test = _profiler, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+#endif
+#ifdef LOX_JIT
+        {
+            .name = (char *)"jit set global", 
+            .test = _jit_set_global, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"jit tail calls", 
+            .test = _jit_tail_calls, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+        {
+            .name = (char *)"jit trace body locals", 
+            .test = _jit_trace_body_locals, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+#endif
+#ifdef LOX_PERF
+        {
+            .name = (char *)"perf counters", 
+            .test = _perf_counters, 
+            .setup = NULL, 
+            .tear_down = NULL, 
+            .options = MUNIT_TEST_OPTION_NONE,
+            .parameters = NULL,
+        },
+#endif
 
         // END
         {NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "timeline.h"
+#include "lib/clock.h"
+
+typedef struct {
+    uint64_t time;      // nanoseconds since the timeline started
+    char     phase;     // 'B' begins a span, 'E' ends the latest open one
+    uint8_t  category;
+    char     name[TIMELINE_NAME_LENGTH];
+} timeline_event_t;
+
+typedef struct {
+    const char*       path;
+    timeline_event_t* events;
+    uint64_t          written;  // total recorded, the next slot is written & (TIMELINE_CAPACITY - 1)
+    uint64_t          start;
+} timeline_t;
+
+static timeline_t _timeline;
+
+static const char* _category_names[] = {
+    [TIMELINE_SCRIPT]  = "script",
+    [TIMELINE_NATIVE]  = "native",
+    [TIMELINE_COMPILE] = "compile",
+    [TIMELINE_GC]      = "gc",
+};
+
+static timeline_event_t* _record(char phase, TimelineCategory category) {
+    timeline_event_t* event = &_timeline.events[_timeline.written++ & (TIMELINE_CAPACITY - 1)];
+    event->time = l_now_ns() - _timeline.start;
+    event->phase = phase;
+    event->category = (uint8_t)category;
+    return event;
+}
+
+static void _set_name(timeline_event_t* event, const char* name, int length) {
+    if (length >= TIMELINE_NAME_LENGTH)
+        length = TIMELINE_NAME_LENGTH - 1;
+    memcpy(event->name, name, length);
+    event->name[length] = '\0';
+}
+
+void l_timeline_begin(TimelineCategory category, const char* name) {
+    timeline_event_t* event = _record('B', category);
+    _set_name(event, name, (int)strlen(name));
+}
+
+void l_timeline_begin_function(obj_function_t* function) {
+    timeline_event_t* event = _record('B', TIMELINE_SCRIPT);
+    if (function->name == NULL)
+        _set_name(event, "script", 6);
+    else
+        _set_name(event, function->name->chars, function->name->length);
+}
+
+void l_timeline_end(TimelineCategory category) {
+    _record('E', category)->name[0] = '\0';
+}
+
+bool l_timeline_start(const char* path) {
+    if (vm.timeline_enabled)
+        return false;
+
+    _timeline.events = malloc(sizeof(timeline_event_t) * TIMELINE_CAPACITY);
+    if (_timeline.events == NULL)
+        return false;
+
+    _timeline.path = path;
+    _timeline.written = 0;
+    _timeline.start = l_now_ns();
+    vm.timeline_enabled = true;
+    return true;
+}
+
+static void _write_event(FILE* file, bool first, char phase, uint8_t category,
+                         const char* name, uint64_t time) {
+    fprintf(file, "%s\n{\"ph\":\"%c\",\"cat\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":1",
+            first ? "" : ",",
+            phase,
+            _category_names[category],
+            time / 1000.0);
+
+    if (phase == 'B') {
+        fputs(",\"name\":\"", file);
+        for (const char* c = name; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\')
+                fputc('\\', file);
+            fputc(*c, file);
+        }
+        fputc('"', file);
+    }
+    fputc('}', file);
+}
+
+void l_timeline_stop() {
+    if (!vm.timeline_enabled)
+        return;
+    vm.timeline_enabled = false;
+
+    FILE* file = fopen(_timeline.path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", _timeline.path);
+    } else {
+        uint64_t first = _timeline.written > TIMELINE_CAPACITY ? _timeline.written - TIMELINE_CAPACITY : 0;
+
+        // the categories of the open spans, to close them at the end
+        static uint8_t open[TIMELINE_CAPACITY];
+        int depth = 0;
+        bool written = false;
+        uint64_t last = 0;
+
+        fputs("{\"traceEvents\":[", file);
+        for (uint64_t i = first; i < _timeline.written; i++) {
+            timeline_event_t* event = &_timeline.events[i & (TIMELINE_CAPACITY - 1)];
+            last = event->time;
+
+            if (event->phase == 'E') {
+                // the span began before the oldest event kept
+                if (depth == 0)
+                    continue;
+                depth--;
+            } else {
+                open[depth++] = event->category;
+            }
+
+            _write_event(file, !written, event->phase, event->category, event->name, event->time);
+            written = true;
+        }
+
+        while (depth > 0) {
+            _write_event(file, !written, 'E', open[--depth], "", last);
+            written = true;
+        }
+        fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+        fclose(file);
+    }
+
+    free(_timeline.events);
+    memset(&_timeline, 0, sizeof(_timeline));
+}
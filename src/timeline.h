@@ -0,0 +1,46 @@
+#ifndef LOX_TIMELINE_H
+#define LOX_TIMELINE_H
+
+#include "common.h"
+#include "object.h"
+#include "vm.h"
+
+// events kept, once full the oldest are overwritten
+#define TIMELINE_CAPACITY (1 << 16)
+// longest span name kept, longer names are cut
+#define TIMELINE_NAME_LENGTH 48
+
+typedef enum {
+    TIMELINE_SCRIPT,   // Lox function calls
+    TIMELINE_NATIVE,   // native function calls
+    TIMELINE_COMPILE,  // compiling, optimising, loading bytecode and JIT compiling
+    TIMELINE_GC,       // collections and their mark and sweep phases
+} TimelineCategory;
+
+// Starts recording spans into a fixed size ring buffer. Recording only
+// writes the next slot, it never allocates or takes a lock, so it can be
+// left on while a slow run is reproduced.
+bool l_timeline_start(const char* path);
+
+// Stops recording and writes the spans in the ring buffer to the path given
+// to l_timeline_start in the Chrome trace event JSON format, which Perfetto
+// and chrome://tracing open. Spans whose start was overwritten are dropped
+// and spans still open are closed at the last event.
+void l_timeline_stop();
+
+void l_timeline_begin(TimelineCategory category, const char* name);
+void l_timeline_begin_function(obj_function_t* function);
+void l_timeline_end(TimelineCategory category);
+
+// the VM checks vm.timeline_enabled before calling into the timeline so
+// recording costs a branch when it's off
+#define TIMELINE_BEGIN(category, name) \
+    do { if (vm.timeline_enabled) l_timeline_begin(category, name); } while (false)
+
+#define TIMELINE_BEGIN_FUNCTION(function) \
+    do { if (vm.timeline_enabled) l_timeline_begin_function(function); } while (false)
+
+#define TIMELINE_END(category) \
+    do { if (vm.timeline_enabled) l_timeline_end(category); } while (false)
+
+#endif
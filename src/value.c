@@ -55,7 +55,14 @@ bool l_values_equal(value_t a, value_t b) {
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NIL:    return true;
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_OBJ: {
+            if (AS_OBJ(a) == AS_OBJ(b))
+                return true;
+            // strings are interned lazily, so compare content for strings
+            if (IS_STRING(a) && IS_STRING(b))
+                return l_strings_equal(AS_STRING(a), AS_STRING(b));
+            return false;
+        }
         default:         return false; // Unreachable.
     }
 }
\ No newline at end of file
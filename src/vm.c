@@ -1,3 +1,4 @@
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -6,8 +7,18 @@
 
 #include "lib/memory.h"
 #include "lib/debug.h"
+#include "lib/heap.h"
+#include "lib/opstats.h"
+#include "buffer.h"
 #include "common.h"
 #include "compiler.h"
+#include "coverage.h"
+#include "inliner.h"
+#include "jit.h"
+#include "perf.h"
+#include "profiler.h"
+#include "serialize.h"
+#include "timeline.h"
 #include "vm.h"
 
 vm_t vm;
@@ -23,23 +34,234 @@ static value_t _usleep_native(int argCount, value_t* args) {
     return NUMBER_VAL(-1);
 }
 
+static value_t _len_native(int argCount, value_t* args) {
+    if (argCount != 1)
+        return NIL_VAL;
+
+    if (IS_STRING(args[0]))
+        return NUMBER_VAL(AS_STRING(args[0])->length);
+    if (IS_LIST(args[0]))
+        return NUMBER_VAL(AS_LIST(args[0])->items.count);
+    if (IS_MAP(args[0]))
+        return NUMBER_VAL(AS_MAP(args[0])->table.count);
+    if (IS_BUFFER(args[0]))
+        return NUMBER_VAL(AS_BUFFER(args[0])->count);
+
+    return NIL_VAL;
+}
+
+static value_t _append_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_LIST(args[0]))
+        return NIL_VAL;
+
+    l_write_value_array(&AS_LIST(args[0])->items, args[1]);
+    return args[0];
+}
+
+static value_t _has_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_MAP(args[0]))
+        return BOOL_VAL(false);
+
+    value_t value;
+    return BOOL_VAL(l_map_table_get(&AS_MAP(args[0])->table, args[1], &value));
+}
+
+static value_t _remove_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_MAP(args[0]))
+        return BOOL_VAL(false);
+
+    return BOOL_VAL(l_map_table_delete(&AS_MAP(args[0])->table, args[1]));
+}
+
+static value_t _keys_native(int argCount, value_t* args) {
+    if (argCount != 1 || !IS_MAP(args[0]))
+        return NIL_VAL;
+
+    map_table_t* table = &AS_MAP(args[0])->table;
+    obj_list_t* keys = l_new_list();
+    l_push(OBJ_VAL(keys));
+    for (int i = l_map_table_next(table, -1); i != -1; i = l_map_table_next(table, i)) {
+        l_write_value_array(&keys->items, table->entries[i].key);
+    }
+    l_pop();
+    return OBJ_VAL(keys);
+}
+
+static value_t _buffer_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_STRING(args[0]) || !IS_NUMBER(args[1]))
+        return NIL_VAL;
+
+    BufferType type;
+    obj_string_t* name = AS_STRING(args[0]);
+    if (!l_buffer_type_from_name(name->chars, name->length, &type))
+        return NIL_VAL;
+
+    // NaN fails both comparisons, fractional counts aren't truncated
+    double count = AS_NUMBER(args[1]);
+    if (!(count >= 0 && count <= INT32_MAX / sizeof(double)) || count != floor(count))
+        return NIL_VAL;
+
+    return OBJ_VAL(l_new_buffer(type, (int)count));
+}
+
+static value_t _fill_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_BUFFER(args[0]) || !IS_NUMBER(args[1]))
+        return NIL_VAL;
+
+    l_buffer_fill(AS_BUFFER(args[0]), AS_NUMBER(args[1]));
+    return args[0];
+}
+
+static value_t _sum_native(int argCount, value_t* args) {
+    if (argCount != 1 || !IS_BUFFER(args[0]))
+        return NIL_VAL;
+
+    return NUMBER_VAL(l_buffer_sum(AS_BUFFER(args[0])));
+}
+
+static value_t _min_native(int argCount, value_t* args) {
+    if (argCount != 1 || !IS_BUFFER(args[0]) || AS_BUFFER(args[0])->count == 0)
+        return NIL_VAL;
+
+    return NUMBER_VAL(l_buffer_min(AS_BUFFER(args[0])));
+}
+
+static value_t _max_native(int argCount, value_t* args) {
+    if (argCount != 1 || !IS_BUFFER(args[0]) || AS_BUFFER(args[0])->count == 0)
+        return NIL_VAL;
+
+    return NUMBER_VAL(l_buffer_max(AS_BUFFER(args[0])));
+}
+
+static value_t _scale_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_BUFFER(args[0]) || !IS_NUMBER(args[1]))
+        return NIL_VAL;
+
+    l_buffer_scale(AS_BUFFER(args[0]), AS_NUMBER(args[1]));
+    return args[0];
+}
+
+static value_t _copy_native(int argCount, value_t* args) {
+    if (argCount != 2 || !IS_BUFFER(args[0]) || !IS_BUFFER(args[1]))
+        return NIL_VAL;
+
+    return NUMBER_VAL(l_buffer_copy(AS_BUFFER(args[0]), AS_BUFFER(args[1])));
+}
+
+// the map must be on the stack, the key is kept there while it's inserted
+static void _set_stat(obj_map_t* map, const char* key, value_t value) {
+    l_push(value);
+    l_push(OBJ_VAL(l_copy_string(key, (int)strlen(key))));
+    l_map_table_set(&map->table, vm.stack_top[-1], vm.stack_top[-2]);
+    l_pop();
+    l_pop();
+}
+
+static double _milliseconds(uint64_t nanoseconds) {
+    return (double)nanoseconds / 1000000.0;
+}
+
+// gcStats() returns a map of vm.gc_stats, times are in milliseconds and
+// "pauses" lists the pause histogram buckets
+static value_t _gc_stats_native(int argCount, value_t* args) {
+    // copied before anything is allocated, a collection while the map is
+    // built would change the stats part way through
+    gc_stats_t stats = vm.gc_stats;
+    size_t     heapBytes = vm.bytes_allocated;
+    size_t     nextGC = vm.next_gc;
+
+    obj_map_t* map = l_new_map();
+    l_push(OBJ_VAL(map));
+
+    _set_stat(map, "collections", NUMBER_VAL((double)stats.collections));
+    _set_stat(map, "bytesReclaimed", NUMBER_VAL((double)stats.bytes_reclaimed));
+    _set_stat(map, "objectsReclaimed", NUMBER_VAL((double)stats.objects_reclaimed));
+    _set_stat(map, "heapBytes", NUMBER_VAL((double)heapBytes));
+    _set_stat(map, "nextGC", NUMBER_VAL((double)nextGC));
+    _set_stat(map, "peakBytes", NUMBER_VAL((double)stats.peak_bytes));
+    _set_stat(map, "totalPause", NUMBER_VAL(_milliseconds(stats.total_pause)));
+    _set_stat(map, "maxPause", NUMBER_VAL(_milliseconds(stats.max_pause)));
+    _set_stat(map, "lastPause", NUMBER_VAL(_milliseconds(stats.last_pause)));
+    _set_stat(map, "markTime", NUMBER_VAL(_milliseconds(stats.mark_time)));
+    _set_stat(map, "sweepTime", NUMBER_VAL(_milliseconds(stats.sweep_time)));
+
+    obj_list_t* pauses = l_new_list();
+    _set_stat(map, "pauses", OBJ_VAL(pauses));
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        l_write_value_array(&pauses->items, NUMBER_VAL((double)stats.pause_histogram[i]));
+    }
+
+    obj_map_t* objects = l_new_map();
+    _set_stat(map, "liveObjects", OBJ_VAL(objects));
+    obj_map_t* bytes = l_new_map();
+    _set_stat(map, "liveBytes", OBJ_VAL(bytes));
+    for (int type = 0; type < OBJ_TYPE_COUNT; type++) {
+        if (stats.live_objects[type] == 0)
+            continue;
+        _set_stat(objects, obj_type_to_string[type], NUMBER_VAL((double)stats.live_objects[type]));
+        _set_stat(bytes, obj_type_to_string[type], NUMBER_VAL((double)stats.live_bytes[type]));
+    }
+
+    l_pop();
+    return OBJ_VAL(map);
+}
+
+// heapSnapshot(path) writes a snapshot of the objects reachable from the
+// roots to path, returning whether it could be written
+static value_t _heap_snapshot_native(int argCount, value_t* args) {
+    if (argCount != 1 || !IS_STRING(args[0]))
+        return NIL_VAL;
+
+    return BOOL_VAL(l_write_heap_snapshot(AS_CSTRING(args[0])));
+}
+
+#ifdef LOX_UNIT
+// set by a failed assert, reported as a runtime error once it returns
+static char _assert_failure[256];
+static bool _assert_failed = false;
+
+// assert(condition, what) fails the script naming what when condition is
+// nil or false. Only the unit tests have it, their scripts check values
+// with it since the runner only sees whether a script succeeded.
+static value_t _assert_native(int argCount, value_t* args) {
+    if (argCount < 1 || !(IS_NIL(args[0]) || (IS_BOOL(args[0]) && !AS_BOOL(args[0]))))
+        return NIL_VAL;
+
+    snprintf(_assert_failure, sizeof(_assert_failure), "Assertion failed: %s",
+             argCount > 1 && IS_STRING(args[1]) ? AS_CSTRING(args[1]) : "assert()");
+    _assert_failed = true;
+    return NIL_VAL;
+}
+#endif
+
 static value_t _peek(int distance);
 static bool    _call(obj_closure_t* closure, int argCount);
+static bool    _call_inline(obj_function_t* function, int argCount);
 static bool    _call_value(value_t callee, int argCount);
 static bool    _invoke(obj_string_t* name, int argCount);
 static bool    _invoke_from_class(obj_class_t* klass, obj_string_t* name, int argCount);
+static bool    _tail_call_value(value_t callee, int argCount);
+static bool    _tail_invoke(obj_string_t* name, int argCount);
 static bool    _bind_method(obj_class_t* klass, obj_string_t* name);
 
-static obj_upvalue_t* _capture_upvalue(value_t* local);
-static void    _close_upvalues(value_t* last);
 static void    _define_method(obj_string_t* name);
 static bool    _is_falsey(value_t value);
 static void    _concatenate();
+static bool    _binary_fallback(uint8_t op, value_t a, value_t b, value_t* result);
+static bool    _get_index();
+static bool    _set_index();
 
 static void _reset_stack() {
+    // frames unwound by an error end their spans here
+    for (int i = 0; i < vm.frame_count; i++) {
+        TIMELINE_END(TIMELINE_SCRIPT);
+    }
     vm.stack_top = vm.stack;
     vm.frame_count = 0;
     vm.open_upvalues = NULL;
+#ifdef LOX_JIT
+    l_trace_abort();
+#endif
 }
 
 static void _runtime_error(const char* format, ...) {
@@ -51,14 +273,14 @@ static void _runtime_error(const char* format, ...) {
 
     callframe_t* frame = &vm.frames[vm.frame_count - 1];
     size_t instruction = frame->ip - frame->closure->function->chunk.code - 1;
-    int line = frame->closure->function->chunk.lines[instruction];
+    int line = l_get_line(&frame->closure->function->chunk, instruction);
     fprintf(stderr, "[line %d] in script\n", line);
 
     for (int i = vm.frame_count - 1; i >= 0; i--) {
         callframe_t* frame = &vm.frames[i];
         obj_function_t* function = frame->closure->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        fprintf(stderr, "[line %d] in ", l_get_line(&function->chunk, instruction));
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -69,8 +291,8 @@ static void _runtime_error(const char* format, ...) {
 }
 
 static void _define_native(const char* name, native_func_t function) {
-    l_push(OBJ_VAL(l_copy_string(name, (int)strlen(name))));
-    l_push(OBJ_VAL(l_new_native(function)));
+    l_push(OBJ_VAL(l_copy_interned_string(name, (int)strlen(name))));
+    l_push(OBJ_VAL(l_new_native(name, function)));
     l_table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
     l_pop();
     l_pop();
@@ -86,17 +308,41 @@ void l_init_vm() {
     vm.gray_count = 0;
     vm.gray_capacity = 0;
     vm.gray_stack = NULL;
+    memset(&vm.gc_stats, 0, sizeof(vm.gc_stats));
+#ifdef LOX_BENCH
+    vm.instruction_count = 0;
+#endif
+
+    vm.budget_slice = 0;
+    vm.suspended = false;
 
     l_init_table(&vm.globals);
     l_init_table(&vm.strings);
 
     vm.init_string = NULL;
-    vm.init_string = l_copy_string("init", 4);
+    vm.init_string = l_copy_interned_string("init", 4);
 
 
     // native functions
     _define_native("clock", _clock_native);
     _define_native("usleep", _usleep_native);
+    _define_native("len", _len_native);
+    _define_native("append", _append_native);
+    _define_native("has", _has_native);
+    _define_native("remove", _remove_native);
+    _define_native("keys", _keys_native);
+    _define_native("buffer", _buffer_native);
+    _define_native("fill", _fill_native);
+    _define_native("sum", _sum_native);
+    _define_native("min", _min_native);
+    _define_native("max", _max_native);
+    _define_native("scale", _scale_native);
+    _define_native("copy", _copy_native);
+    _define_native("gcStats", _gc_stats_native);
+    _define_native("heapSnapshot", _heap_snapshot_native);
+#ifdef LOX_UNIT
+    _define_native("assert", _assert_native);
+#endif
 }
 
 void l_free_vm() {
@@ -104,10 +350,56 @@ void l_free_vm() {
     l_free_table(&vm.globals);
     vm.init_string = NULL;
     l_free_objects();
+#ifdef DEBUG_OPCODE_STATS
+    l_opstats_report(stderr);
+#endif
+    // after the objects, mapped strings and chunks point into the images
+    l_free_bytecode_images();
+}
+
+static inline value_t _number_binary(uint8_t op, double a, double b) {
+    switch (op) {
+        case OP_EQUAL:    return BOOL_VAL(a == b);
+        case OP_GREATER:  return BOOL_VAL(a > b);
+        case OP_LESS:     return BOOL_VAL(a < b);
+        case OP_ADD:      return NUMBER_VAL(a + b);
+        case OP_SUBTRACT: return NUMBER_VAL(a - b);
+        case OP_MULTIPLY: return NUMBER_VAL(a * b);
+        case OP_DIVIDE:   return NUMBER_VAL(a / b);
+        default:          return NIL_VAL;
+    }
+}
+
+// Takes the samples the profiler and the performance counters flagged.
+// Polled at back edges, calls and returns instead of before every
+// instruction, the code between them is straight line so a sample is only
+// ever a few instructions late.
+static void _handle_events() {
+    // cleared first, a flag set while the samples are taken is seen at the
+    // next poll
+    vm.event_pending = 0;
+#ifdef LOX_PROFILER
+    if (vm.sample_pending) {
+        l_profile_sample();
+    }
+#endif
+#ifdef LOX_PERF
+    if (vm.perf_sample_pending) {
+        l_perf_sample();
+    }
+#endif
 }
 
 static InterpretResult _run() {
-    callframe_t* frame = &vm.frames[vm.frame_count - 1];
+    callframe_t* frame;
+#ifdef LOX_JIT
+    jit_code_t*  jit;
+#define LOAD_FRAME() \
+    (frame = &vm.frames[vm.frame_count - 1], jit = frame->closure->function->jit)
+#else
+#define LOAD_FRAME() (frame = &vm.frames[vm.frame_count - 1])
+#endif
+    LOAD_FRAME();
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
@@ -124,11 +416,51 @@ static InterpretResult _run() {
         double a = AS_NUMBER(l_pop()); \
         l_push(valueType(a op b)); \
     } while (false)
+#define POLL_EVENTS() \
+    do { \
+        if (vm.event_pending) { \
+            _handle_events(); \
+        } \
+    } while (false)
+#define CHECK_BUDGET() \
+    do { \
+        if (vm.budget_slice != 0 && --vm.budget <= 0) { \
+            vm.suspended = true; \
+            return INTERPRET_SUSPENDED; \
+        } \
+    } while (false)
+#define REGISTER_BINARY(op, a, b, result) \
+    do { \
+        if (IS_NUMBER(a) && IS_NUMBER(b)) { \
+            result = _number_binary(op, AS_NUMBER(a), AS_NUMBER(b)); \
+        } \
+        else if (!_binary_fallback(op, a, b, &result)) { \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } while (false)
 
 
 
     for (;;) {
 
+#ifdef LOX_JIT
+        // run native code until it reaches an instruction it can't handle
+        if (jit != NULL && vm.budget_slice == 0) {
+            l_jit_execute(frame);
+        }
+        if (vm.trace_recording) {
+            l_trace_record(frame);
+        }
+#endif
+
+#ifdef LOX_BENCH
+        vm.instruction_count++;
+#endif
+
+#ifdef DEBUG_OPCODE_STATS
+        l_opstats_record(*frame->ip);
+#endif
+
 #ifdef DEBUG_TRACE_EXECUTION
         printf("          ");
         for (value_t* slot = vm.stack; slot < vm.stack_top; slot++) {
@@ -298,33 +630,67 @@ static InterpretResult _run() {
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
+                POLL_EVENTS();
+                CHECK_BUDGET();
+#ifdef LOX_JIT
+                if (l_jit_enabled() && vm.budget_slice == 0) {
+                    l_trace_loop(frame);
+                }
+#endif
                 break;
             }
             case OP_CALL: {
+                POLL_EVENTS();
                 int argCount = READ_BYTE();
                 if (!_call_value(_peek(argCount), argCount)) {
                    return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1];
+                LOAD_FRAME();
+                CHECK_BUDGET();
                 break;
             }
             case OP_INVOKE: {
+                POLL_EVENTS();
                 obj_string_t* method = READ_STRING();
                 int argCount = READ_BYTE();
                 if (!_invoke(method, argCount)) {
                    return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1];
+                LOAD_FRAME();
+                CHECK_BUDGET();
+                break;
+            }
+            case OP_TAIL_CALL: {
+                POLL_EVENTS();
+                int argCount = READ_BYTE();
+                if (!_tail_call_value(_peek(argCount), argCount)) {
+                   return INTERPRET_RUNTIME_ERROR;
+                }
+                LOAD_FRAME();
+                CHECK_BUDGET();
+                break;
+            }
+            case OP_TAIL_INVOKE: {
+                POLL_EVENTS();
+                obj_string_t* method = READ_STRING();
+                int argCount = READ_BYTE();
+                if (!_tail_invoke(method, argCount)) {
+                   return INTERPRET_RUNTIME_ERROR;
+                }
+                LOAD_FRAME();
+                CHECK_BUDGET();
                 break;
             }
             case OP_SUPER_INVOKE: {
+                POLL_EVENTS();
                 obj_string_t* method = READ_STRING();
                 int argCount = READ_BYTE();
                 obj_class_t* superclass = AS_CLASS(l_pop());
                 if (!_invoke_from_class(superclass, method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frame_count - 1];
+                LOAD_FRAME();
+                CHECK_BUDGET();
                 break;
             }
             case OP_CLOSURE: {
@@ -336,7 +702,7 @@ static InterpretResult _run() {
                     uint8_t isLocal = READ_BYTE();
                     uint8_t index = READ_BYTE();
                     if (isLocal) {
-                        closure->upvalues[i] = _capture_upvalue(frame->slots + index);
+                        closure->upvalues[i] = l_capture_upvalue(frame->slots + index);
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
@@ -344,13 +710,15 @@ static InterpretResult _run() {
                 break;
             }
             case OP_CLOSE_UPVALUE:
-                _close_upvalues(vm.stack_top - 1);
+                l_close_upvalues(vm.stack_top - 1);
                 l_pop();
                 break;
             case OP_RETURN: {
+                POLL_EVENTS();
                 value_t result = l_pop();
-                _close_upvalues(frame->slots);
+                l_close_upvalues(frame->slots);
                 vm.frame_count--;
+                TIMELINE_END(TIMELINE_SCRIPT);
                 if (vm.frame_count == 0) {
                     l_pop();
                     return INTERPRET_OK;
@@ -358,7 +726,7 @@ static InterpretResult _run() {
 
                 vm.stack_top = frame->slots;
                 l_push(result);
-                frame = &vm.frames[vm.frame_count - 1];
+                LOAD_FRAME();
                 break;
             }
             case OP_CLASS:
@@ -378,6 +746,80 @@ static InterpretResult _run() {
             case OP_METHOD:
                 _define_method(READ_STRING());
                 break;
+            case OP_BUILD_LIST: {
+                int itemCount = READ_BYTE();
+                obj_list_t* list = l_new_list();
+                l_push(OBJ_VAL(list));
+                for (int i = itemCount; i > 0; i--) {
+                    l_write_value_array(&list->items, _peek(i));
+                }
+                vm.stack_top -= itemCount + 1;
+                l_push(OBJ_VAL(list));
+                break;
+            }
+            case OP_BUILD_MAP: {
+                int entryCount = READ_BYTE();
+                obj_map_t* map = l_new_map();
+                l_push(OBJ_VAL(map));
+                for (int i = entryCount * 2; i > 0; i -= 2) {
+                    l_map_table_set(&map->table, _peek(i), _peek(i - 1));
+                }
+                vm.stack_top -= entryCount * 2 + 1;
+                l_push(OBJ_VAL(map));
+                break;
+            }
+            case OP_GET_INDEX:
+                if (!_get_index()) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            case OP_SET_INDEX:
+                if (!_set_index()) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            case OP_BINARY_LL: {
+                uint8_t op = READ_BYTE();
+                value_t a = frame->slots[READ_BYTE()];
+                value_t b = frame->slots[READ_BYTE()];
+                value_t result;
+                REGISTER_BINARY(op, a, b, result);
+                l_push(result);
+                break;
+            }
+            case OP_BINARY_LK: {
+                uint8_t op = READ_BYTE();
+                value_t a = frame->slots[READ_BYTE()];
+                value_t b = READ_CONSTANT();
+                value_t result;
+                REGISTER_BINARY(op, a, b, result);
+                l_push(result);
+                break;
+            }
+            case OP_STORE_BINARY_LL: {
+                uint8_t op = READ_BYTE();
+                uint8_t dst = READ_BYTE();
+                value_t a = frame->slots[READ_BYTE()];
+                value_t b = frame->slots[READ_BYTE()];
+                REGISTER_BINARY(op, a, b, frame->slots[dst]);
+                break;
+            }
+            case OP_STORE_BINARY_LK: {
+                uint8_t op = READ_BYTE();
+                uint8_t dst = READ_BYTE();
+                value_t a = frame->slots[READ_BYTE()];
+                value_t b = READ_CONSTANT();
+                REGISTER_BINARY(op, a, b, frame->slots[dst]);
+                break;
+            }
+            case OP_COVERAGE: {
+                // the first time this instruction has run, it's run again
+                // once its opcode is back
+                frame->ip--;
+                l_coverage_hit(frame->closure->function,
+                               (int)(frame->ip - frame->closure->function->chunk.code));
+                break;
+            }
             break;
         }
     }
@@ -387,6 +829,8 @@ static InterpretResult _run() {
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef BINARY_OP
+#undef REGISTER_BINARY
+#undef LOAD_FRAME
 }
 
 InterpretResult l_interpret(const char* source) {
@@ -398,13 +842,58 @@ InterpretResult l_interpret(const char* source) {
         return INTERPRET_COMPILE_ERROR;
     }
 
+    return l_interpret_function(function);
+}
+
+// runs the frames on the stack with a fresh slice of the budget
+static InterpretResult _execute() {
+    vm.budget = vm.budget_slice;
+
+#ifdef LOX_PERF
+    l_perf_run_begin();
+#endif
+    InterpretResult result = _run();
+#ifdef LOX_PERF
+    l_perf_run_end();
+#endif
+    return result;
+}
+
+InterpretResult l_interpret_function(obj_function_t* function) {
+    if (vm.suspended)
+        l_abort();
+
     l_push(OBJ_VAL(function));
     obj_closure_t* closure = l_new_closure(function);
     l_pop();
     l_push(OBJ_VAL(closure));
+
+    if (l_coverage_enabled())
+        l_coverage_patch(function);
     _call(closure, 0);
 
-    return _run();
+    return _execute();
+}
+
+void l_set_budget(int64_t steps) {
+    vm.budget_slice = steps > 0 ? steps : 0;
+}
+
+InterpretResult l_resume() {
+    if (!vm.suspended)
+        return INTERPRET_RUNTIME_ERROR;
+
+    vm.suspended = false;
+    return _execute();
+}
+
+void l_abort() {
+    if (!vm.suspended)
+        return;
+
+    l_close_upvalues(vm.stack);
+    _reset_stack();
+    vm.suspended = false;
 }
 
 void l_push(value_t value) {
@@ -421,6 +910,20 @@ static value_t _peek(int distance) {
     return vm.stack_top[-1 - distance];
 }
 
+// compiles a function to native code once it has been called often enough
+static void _count_call(obj_function_t* function) {
+#ifdef LOX_JIT
+    if (function->jit == NULL && l_jit_enabled() &&
+        ++function->call_count == JIT_HOT_CALLS) {
+        TIMELINE_BEGIN(TIMELINE_COMPILE, "jit");
+        l_jit_compile(function);
+        TIMELINE_END(TIMELINE_COMPILE);
+    }
+#else
+    (void)function;
+#endif
+}
+
 static bool _call(obj_closure_t* closure, int argCount) {
     if (argCount != closure->function->arity) {
         _runtime_error(
@@ -431,6 +934,13 @@ static bool _call(obj_closure_t* closure, int argCount) {
         return false;
     }
 
+    if (closure->function->inline_kind != INLINE_NONE &&
+        _call_inline(closure->function, argCount)) {
+        return true;
+    }
+
+    _count_call(closure->function);
+
     if (vm.frame_count == FRAMES_MAX) {
         _runtime_error("Stack overflow.");
         return false;
@@ -440,6 +950,69 @@ static bool _call(obj_closure_t* closure, int argCount) {
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stack_top - argCount - 1;
+    TIMELINE_BEGIN_FUNCTION(closure->function);
+    return true;
+}
+
+// Evaluates a leaf function in place of the callee and its arguments
+// without pushing a frame. Returns false when a guard fails, leaving the
+// stack untouched for a normal call.
+static bool _call_inline(obj_function_t* function, int argCount) {
+    value_t* slots = vm.stack_top - argCount - 1;
+    value_t* constants = function->chunk.constants.values;
+    value_t  result;
+
+    switch (function->inline_kind) {
+        case INLINE_CONSTANT:
+            switch (function->inline_op) {
+                case OP_NIL:   result = NIL_VAL; break;
+                case OP_TRUE:  result = BOOL_VAL(true); break;
+                case OP_FALSE: result = BOOL_VAL(false); break;
+                default:       result = constants[function->inline_a]; break;
+            }
+            break;
+        case INLINE_PARAMETER:
+            result = slots[function->inline_a];
+            break;
+        case INLINE_GETTER: {
+            if (!IS_INSTANCE(slots[0]))
+                return false;
+
+            // methods and missing fields take the normal path
+            obj_string_t* name = AS_STRING(constants[function->inline_a]);
+            if (!l_table_get(&AS_INSTANCE(slots[0])->fields, name, &result))
+                return false;
+            break;
+        }
+        case INLINE_SETTER: {
+            if (!IS_INSTANCE(slots[0]))
+                return false;
+
+            obj_instance_t* instance = AS_INSTANCE(slots[0]);
+            const uint8_t*  store = function->chunk.code;
+            for (int i = 0; i < function->inline_a; i++, store += INLINE_SETTER_STORE_LENGTH) {
+                l_table_set(&instance->fields, AS_STRING(constants[store[5]]), slots[store[3]]);
+            }
+            result = function->inline_b ? slots[0] : NIL_VAL;
+            break;
+        }
+        case INLINE_BINARY_LL:
+        case INLINE_BINARY_LK: {
+            value_t a = slots[function->inline_a];
+            value_t b = function->inline_kind == INLINE_BINARY_LL ? slots[function->inline_b]
+                                                                  : constants[function->inline_b];
+            if (!IS_NUMBER(a) || !IS_NUMBER(b))
+                return false;
+
+            result = _number_binary(function->inline_op, AS_NUMBER(a), AS_NUMBER(b));
+            break;
+        }
+        default:
+            return false;
+    }
+
+    vm.stack_top = slots;
+    l_push(result);
     return true;
 }
 
@@ -470,7 +1043,16 @@ static bool _call_value(value_t callee, int argCount) {
                 return _call(AS_CLOSURE(callee), argCount);
             case OBJ_NATIVE: {
                 native_func_t native = AS_NATIVE(callee);
+                TIMELINE_BEGIN(TIMELINE_NATIVE, ((obj_native_t*)AS_OBJ(callee))->name);
                 value_t result = native(argCount, vm.stack_top - argCount);
+                TIMELINE_END(TIMELINE_NATIVE);
+#ifdef LOX_UNIT
+                if (_assert_failed) {
+                    _assert_failed = false;
+                    _runtime_error("%s", _assert_failure);
+                    return false;
+                }
+#endif
                 vm.stack_top -= argCount + 1;
                 l_push(result);
                 return true;
@@ -511,6 +1093,74 @@ static bool _invoke(obj_string_t* name, int argCount) {
     return _invoke_from_class(instance->klass, name, argCount);
 }
 
+// Calls a closure by replacing the current frame with it. Upvalues that
+// point at the caller's slots are closed before the callee and its
+// arguments are moved down over them. Anything else is called normally and
+// the OP_RETURN that follows a tail call returns its result.
+static bool _tail_call_value(value_t callee, int argCount) {
+    if (IS_BOUND_METHOD(callee)) {
+        obj_bound_method_t* bound = AS_BOUND_METHOD(callee);
+        vm.stack_top[-argCount - 1] = bound->receiver;
+        callee = OBJ_VAL(bound->method);
+    }
+
+    if (!IS_CLOSURE(callee))
+        return _call_value(callee, argCount);
+
+    obj_closure_t* closure = AS_CLOSURE(callee);
+    if (argCount != closure->function->arity) {
+        _runtime_error(
+            "Expected %d arguments but got %d.",
+            closure->function->arity, 
+            argCount
+        );
+        return false;
+    }
+
+    if (closure->function->inline_kind != INLINE_NONE &&
+        _call_inline(closure->function, argCount)) {
+        return true;
+    }
+
+    _count_call(closure->function);
+
+    callframe_t* frame = &vm.frames[vm.frame_count - 1];
+    l_close_upvalues(frame->slots);
+
+    value_t* callSlots = vm.stack_top - argCount - 1;
+    memmove(frame->slots, callSlots, sizeof(value_t) * (argCount + 1));
+    vm.stack_top = frame->slots + argCount + 1;
+
+    frame->closure = closure;
+    frame->ip = closure->function->chunk.code;
+    TIMELINE_END(TIMELINE_SCRIPT);
+    TIMELINE_BEGIN_FUNCTION(closure->function);
+    return true;
+}
+
+static bool _tail_invoke(obj_string_t* name, int argCount) {
+    value_t receiver = _peek(argCount);
+
+    if (!IS_INSTANCE(receiver)) {
+        _runtime_error("Only instances have methods.");
+        return false;
+    }
+
+    obj_instance_t* instance = AS_INSTANCE(receiver);
+
+    value_t value;
+    if (l_table_get(&instance->fields, name, &value)) {
+        vm.stack_top[-argCount - 1] = value;
+        return _tail_call_value(value, argCount);
+    }
+
+    if (!l_table_get(&instance->klass->methods, name, &value)) {
+        _runtime_error("Undefined property '%s'.", name->chars);
+        return false;
+    }
+    return _tail_call_value(value, argCount);
+}
+
 static bool _bind_method(obj_class_t* klass, obj_string_t* name) {
     value_t method;
     if (!l_table_get(&klass->methods, name, &method)) {
@@ -524,7 +1174,7 @@ static bool _bind_method(obj_class_t* klass, obj_string_t* name) {
     return true;
 }
 
-static obj_upvalue_t* _capture_upvalue(value_t* local) {
+obj_upvalue_t* l_capture_upvalue(value_t* local) {
     obj_upvalue_t* prevUpvalue = NULL;
     obj_upvalue_t* upvalue = vm.open_upvalues;
     while (upvalue != NULL && upvalue->location > local) {
@@ -549,7 +1199,7 @@ static obj_upvalue_t* _capture_upvalue(value_t* local) {
     return createdUpvalue;
 }
 
-static void _close_upvalues(value_t* last) {
+void l_close_upvalues(value_t* last) {
     while (vm.open_upvalues != NULL &&
            vm.open_upvalues->location >= last) {
 
@@ -571,6 +1221,30 @@ static bool _is_falsey(value_t value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+// slow path for the register forms, matches the stack opcodes for strings,
+// equality and the errors they report
+static bool _binary_fallback(uint8_t op, value_t a, value_t b, value_t* result) {
+    if (op == OP_EQUAL) {
+        *result = BOOL_VAL(l_values_equal(a, b));
+        return true;
+    }
+
+    if (op == OP_ADD) {
+        if (IS_STRING(a) && IS_STRING(b)) {
+            l_push(a);
+            l_push(b);
+            _concatenate();
+            *result = l_pop();
+            return true;
+        }
+        _runtime_error("Operands must be two numbers or two strings.");
+        return false;
+    }
+
+    _runtime_error("Operands must be numbers.");
+    return false;
+}
+
 static void _concatenate() {
     obj_string_t* b = AS_STRING(_peek(0));
     obj_string_t* a = AS_STRING(_peek(1));
@@ -587,4 +1261,109 @@ static void _concatenate() {
     l_pop();
 
     l_push(OBJ_VAL(result));
-}
\ No newline at end of file
+}
+
+// kind names the indexed type in the error messages
+static bool _index(value_t index, int count, const char* kind, int* result) {
+    if (!IS_NUMBER(index)) {
+        _runtime_error("%s index must be a number.", kind);
+        return false;
+    }
+
+    // the range is checked while it's a double, NaN fails it and converting
+    // a number out of int's range is undefined
+    double number = AS_NUMBER(index);
+    if (!(number >= 0 && number < count) || (int)number != number) {
+        _runtime_error("%s index out of range.", kind);
+        return false;
+    }
+
+    *result = (int)number;
+    return true;
+}
+
+static bool _get_index() {
+    value_t index = _peek(0);
+    value_t target = _peek(1);
+
+    if (IS_LIST(target)) {
+        obj_list_t* list = AS_LIST(target);
+        int i;
+        if (!_index(index, list->items.count, "List", &i))
+            return false;
+
+        vm.stack_top -= 2;
+        l_push(list->items.values[i]);
+        return true;
+    }
+
+    if (IS_MAP(target)) {
+        // missing keys read as nil
+        value_t value;
+        if (!l_map_table_get(&AS_MAP(target)->table, index, &value))
+            value = NIL_VAL;
+
+        vm.stack_top -= 2;
+        l_push(value);
+        return true;
+    }
+
+    if (IS_BUFFER(target)) {
+        obj_buffer_t* buffer = AS_BUFFER(target);
+        int i;
+        if (!_index(index, buffer->count, "Buffer", &i))
+            return false;
+
+        vm.stack_top -= 2;
+        l_push(NUMBER_VAL(l_buffer_get(buffer, i)));
+        return true;
+    }
+
+    _runtime_error("Only lists, maps and buffers can be indexed.");
+    return false;
+}
+
+static bool _set_index() {
+    value_t value = _peek(0);
+    value_t index = _peek(1);
+    value_t target = _peek(2);
+
+    if (IS_LIST(target)) {
+        obj_list_t* list = AS_LIST(target);
+        int i;
+        if (!_index(index, list->items.count, "List", &i))
+            return false;
+
+        list->items.values[i] = value;
+        vm.stack_top -= 3;
+        l_push(value);
+        return true;
+    }
+
+    if (IS_MAP(target)) {
+        l_map_table_set(&AS_MAP(target)->table, index, value);
+        vm.stack_top -= 3;
+        l_push(value);
+        return true;
+    }
+
+    if (IS_BUFFER(target)) {
+        obj_buffer_t* buffer = AS_BUFFER(target);
+        int i;
+        if (!_index(index, buffer->count, "Buffer", &i))
+            return false;
+
+        if (!IS_NUMBER(value)) {
+            _runtime_error("Buffer values must be numbers.");
+            return false;
+        }
+
+        l_buffer_set(buffer, i, AS_NUMBER(value));
+        vm.stack_top -= 3;
+        l_push(value);
+        return true;
+    }
+
+    _runtime_error("Only lists, maps and buffers can be indexed.");
+    return false;
+}
@@ -1,6 +1,8 @@
 #ifndef LOX_VM_H
 #define LOX_VM_H
 
+#include <signal.h>
+
 #include "object.h"
 #include "table.h"
 #include "value.h"
@@ -14,6 +16,32 @@ typedef struct {
     value_t* slots;
 } callframe_t;
 
+// pauses are counted in power of two microsecond buckets, bucket 0 holds
+// pauses under 1us, bucket n those from 2^(n-1) up to 2^n us and the last
+// bucket everything longer
+#define GC_PAUSE_BUCKETS 20
+
+typedef struct {
+    uint64_t collections;
+    uint64_t bytes_reclaimed;
+    uint64_t objects_reclaimed;
+
+    // nanoseconds
+    uint64_t total_pause;
+    uint64_t max_pause;
+    uint64_t last_pause;
+    uint64_t mark_time;
+    uint64_t sweep_time;
+    uint64_t pause_histogram[GC_PAUSE_BUCKETS];
+
+    // highest vm.bytes_allocated has reached
+    size_t   peak_bytes;
+
+    // what survived the last collection
+    size_t   live_objects[OBJ_TYPE_COUNT];
+    size_t   live_bytes[OBJ_TYPE_COUNT];
+} gc_stats_t;
+
 typedef struct {
     callframe_t frames[FRAMES_MAX];
     int frame_count;
@@ -32,13 +60,50 @@ typedef struct {
     int    gray_count;
     int    gray_capacity;
     obj_t** gray_stack;
+    gc_stats_t gc_stats;
+
+    // spans are being recorded for the timeline
+    bool timeline_enabled;
+
+    // back edges and calls left before the running script is suspended,
+    // refilled from budget_slice on each run, 0 runs without a budget
+    int64_t budget;
+    int64_t budget_slice;
+    // a script ran out of budget and can be resumed or aborted
+    bool    suspended;
+
+#ifdef LOX_JIT
+    // a hot loop is being recorded for the tracing JIT
+    bool trace_recording;
+#endif
+
+#ifdef LOX_BENCH
+    // instructions dispatched by the interpreter, not those run as native
+    // code by the JIT
+    uint64_t instruction_count;
+#endif
+
+    // set by a signal handler along with its own flag below, polled at the
+    // next back edge, call or return so dispatch doesn't check each flag
+    volatile sig_atomic_t event_pending;
+
+#ifdef LOX_PROFILER
+    // set by the profiler's timer when a sample is due
+    volatile sig_atomic_t sample_pending;
+#endif
+
+#ifdef LOX_PERF
+    // set when the performance counters are due to be read
+    volatile sig_atomic_t perf_sample_pending;
+#endif
 
 } vm_t;
 
 typedef enum {
     INTERPRET_OK,
     INTERPRET_COMPILE_ERROR,
-    INTERPRET_RUNTIME_ERROR
+    INTERPRET_RUNTIME_ERROR,
+    INTERPRET_SUSPENDED
 } InterpretResult;
 
 // exposing the vm instance
@@ -50,6 +115,27 @@ void l_free_vm();
 void    l_push(value_t value);
 value_t l_pop();
 
+// the open upvalue for a stack slot, created if the slot has none
+obj_upvalue_t* l_capture_upvalue(value_t* local);
+// closes the open upvalues for every slot from last to the top of the stack
+void           l_close_upvalues(value_t* last);
+
+// Interpreting aborts a script that is still suspended.
 InterpretResult l_interpret(const char * source);
+// runs an already compiled script function, e.g. one loaded from bytecode
+InterpretResult l_interpret_function(obj_function_t* function);
+
+// Bounds each run to a number of steps, one for every loop back edge and
+// every call, so that a script that doesn't finish within its slice
+// returns INTERPRET_SUSPENDED with its frames left on the stack. The same
+// script suspends at the same instruction every time. 0 removes the
+// budget. While a budget is set the JIT's native code isn't entered, as
+// compiled loops don't count their back edges.
+void            l_set_budget(int64_t steps);
+// continues a suspended script with a fresh slice of the budget, returns
+// INTERPRET_RUNTIME_ERROR when nothing is suspended
+InterpretResult l_resume();
+// discards a suspended script, closing its upvalues
+void            l_abort();
 
 #endif
\ No newline at end of file